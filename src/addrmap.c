@@ -0,0 +1,119 @@
+#include "addrmap.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+enum { ADDR_MAP_INITIAL_N_ALLOCATED = 64 };
+
+static size_t addr_map_hash(AddrMap *map, const CpsockAddressKey *key) {
+	// Mix the key 8 bytes at a time (multiply-xorshift, as in SplitMix64).
+	unsigned char bytes[24];
+	memset(bytes, 0, sizeof(bytes));
+	memcpy(bytes, key, sizeof(*key));
+
+	uint64_t hash = map->seed;
+	for (size_t i_word = 0; i_word < sizeof(bytes) / 8; i_word++) {
+		uint64_t word;
+		memcpy(&word, bytes + i_word * 8, sizeof(word));
+		hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 32;
+	}
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 31;
+
+	return hash & (map->n_allocated - 1);
+}
+
+static void addr_map_allocate(AddrMap *map, size_t n_allocated) {
+	map->entries = calloc(n_allocated, sizeof(AddrMapEntry));
+	map->n_allocated = n_allocated;
+	map->n_elems = 0;
+}
+
+void addr_map_init(AddrMap *map, uint64_t seed) {
+	map->seed = seed;
+	addr_map_allocate(map, ADDR_MAP_INITIAL_N_ALLOCATED);
+}
+
+void addr_map_clear(AddrMap *map) {
+	for (size_t i_entry = 0; i_entry < map->n_allocated; i_entry++)
+		map->entries[i_entry].used = false;
+	map->n_elems = 0;
+}
+
+static AddrMapEntry *addr_map_find(AddrMap *map, const CpsockAddressKey *key) {
+	// Return value: the entry with the key, or the unused entry where it would be inserted.
+	size_t i_entry = addr_map_hash(map, key);
+	while (true) {
+		AddrMapEntry *entry = &map->entries[i_entry];
+		if (!entry->used || memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+		i_entry = (i_entry + 1) & (map->n_allocated - 1);
+	}
+}
+
+bool addr_map_get(AddrMap *map, const CpsockAddressKey *key, uint32_t *value) {
+	// Return value: whether the key was found (if so, its value is stored in value).
+	AddrMapEntry *entry = addr_map_find(map, key);
+	if (!entry->used)
+		return false;
+	*value = entry->value;
+	return true;
+}
+
+void addr_map_set(AddrMap *map, const CpsockAddressKey *key, uint32_t value) {
+	// Keep the load factor at most 1/2, so that probe sequences stay short.
+	if ((map->n_elems + 1) * 2 > map->n_allocated) {
+		AddrMapEntry *old_entries = map->entries;
+		size_t old_n_allocated = map->n_allocated;
+		addr_map_allocate(map, old_n_allocated * 2);
+		for (size_t i_entry = 0; i_entry < old_n_allocated; i_entry++) {
+			if (old_entries[i_entry].used) {
+				addr_map_set(map, &old_entries[i_entry].key,
+				             old_entries[i_entry].value);
+			}
+		}
+		free(old_entries);
+	}
+
+	AddrMapEntry *entry = addr_map_find(map, key);
+	if (!entry->used) {
+		entry->used = true;
+		entry->key = *key;
+		map->n_elems++;
+	}
+	entry->value = value;
+}
+
+bool addr_map_delete(AddrMap *map, const CpsockAddressKey *key) {
+	// Return value: whether the key was found.
+
+	AddrMapEntry *entry = addr_map_find(map, key);
+	if (!entry->used)
+		return false;
+
+	// Shift back the following entries of the probe sequence into the hole, so that we don't need tombstones.
+	size_t mask = map->n_allocated - 1;
+	size_t i_hole = entry - map->entries;
+	size_t i_entry = i_hole;
+	while (true) {
+		i_entry = (i_entry + 1) & mask;
+		AddrMapEntry *next = &map->entries[i_entry];
+		if (!next->used)
+			break;
+
+		// Move the entry only if its home slot isn't between the hole and it (cyclically).
+		size_t i_home = addr_map_hash(map, &next->key);
+		if (((i_entry - i_home) & mask) >= ((i_entry - i_hole) & mask)) {
+			map->entries[i_hole] = *next;
+			i_hole = i_entry;
+		}
+	}
+
+	map->entries[i_hole].used = false;
+	map->n_elems--;
+	return true;
+}
@@ -0,0 +1,30 @@
+// Hash table from socket addresses to integers (open addressing with linear probing).
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpsock.h"
+
+typedef struct AddrMapEntry {
+	CpsockAddressKey key;
+	uint32_t value;
+	bool used;
+} AddrMapEntry;
+
+typedef struct AddrMap {
+	AddrMapEntry *entries;
+	size_t n_allocated; // Power of 2.
+	size_t n_elems;
+	uint64_t seed; // Randomizes hashes, so that clients can't choose addresses that collide.
+} AddrMap;
+
+void addr_map_init(AddrMap *map, uint64_t seed);
+
+void addr_map_clear(AddrMap *map);
+
+bool addr_map_get(AddrMap *map, const CpsockAddressKey *key, uint32_t *value);
+
+void addr_map_set(AddrMap *map, const CpsockAddressKey *key, uint32_t value);
+
+bool addr_map_delete(AddrMap *map, const CpsockAddressKey *key);
@@ -0,0 +1,413 @@
+// Benchmarks of the simulation (without the network), on synthetic worlds.
+// Prints CSV with a row for every scenario and phase: how many samples were timed and their mean, median, 99th percentile and maximum in nanoseconds, so that the output of two builds can be compared line by line. Usage: space-shooter-bench [ticks per scenario].
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpsock.h"
+#include "cptime.h"
+#include "histogram.h"
+#include "ring.h"
+#include "rnd.h"
+#include "serialization.h"
+#include "slotmap.h"
+#include "snapshot.h"
+#include "spawn.h"
+#include "vec2f.h"
+#include "vector.h"
+#include "world.h"
+
+// Like in main.c.
+const size_t MAX_DATAGRAM_SIZE = 1200;
+const float PLAYER_TIMEOUT = 30;
+
+const int DEFAULT_N_TICKS = 10 * FPS; // Timed ticks per scenario.
+const int N_WARMUP_TICKS = 2 * FPS; // Before timing, so that projectiles and explosions reach their usual numbers.
+const int INPUT_SCRIPT_INTERVAL = FPS / 2; // Ticks between changes of a player's input.
+const int N_SPAWN_WORLDS = 20; // Random worlds for comparing the spawn search with brute force.
+const int CONTAINER_SPAWN_COUNTS[] = {20, 80, 320}; // Projectiles created per tick when comparing containers for them.
+
+const int PLAYER_COUNTS[] = {8, 32, 100, 300, 1000};
+const int PROJECTILE_COUNTS[] = {0, 1000, 5000};
+
+enum BenchPhase {
+	BENCH_MOVE, // world_move.
+	BENCH_COLLISIONS, // world_detect_collisions.
+	BENCH_TICK, // Both of the above, like the server's simulation phase.
+	BENCH_SPAWN, // world_spawn_position in the world as it is after the tick.
+	BENCH_CAPTURE, // world_capture.
+	BENCH_ENCODE_FULL, // snapshot_encode without a baseline.
+	BENCH_ENCODE_DELTA, // snapshot_encode against the previous tick.
+	BENCH_SEND, // Datagrams of the delta for every player, like send_sim_tick_packets (into a null sink).
+	N_BENCH_PHASES
+};
+
+const char *const BENCH_PHASE_NAMES[N_BENCH_PHASES] = {
+	"move", "collisions", "tick", "spawn", "capture", "encode_full",
+	"encode_delta", "send",
+};
+
+
+/// Utilities.
+
+Vec2f random_position(RndState *rnd) {
+	Vec2f position;
+	position.x = (rnd_next(rnd) >> 40) * (LEVEL_SIZE.x / 16777216.0);
+	position.y = (rnd_next(rnd) >> 40) * (LEVEL_SIZE.y / 16777216.0);
+	return position;
+}
+
+float random_angle(RndState *rnd) {
+	return (rnd_next(rnd) >> 40) * (6.2831853 / 16777216.0);
+}
+
+uint64_t elapsed_ns(Cptime *start, Cptime *end) {
+	double elapsed = cptime_elapsed(start, end);
+	return (elapsed > 0) ? (uint64_t) (elapsed * 1e9) : 0;
+}
+
+void print_row(int n_players, int n_projectiles, const char *phase,
+               const Histogram *histogram) {
+	printf("%d,%d,%s,%lu,%.0f,%lu,%lu,%lu\n", n_players, n_projectiles, phase,
+	       (unsigned long) histogram->n_values, histogram_mean(histogram),
+	       (unsigned long) histogram_percentile(histogram, 50),
+	       (unsigned long) histogram_percentile(histogram, 99),
+	       (unsigned long) histogram->max);
+}
+
+
+/// Simulation.
+
+void script_input(Player *player, RndState *rnd) {
+	// Pick a random input, like a player mashing keys.
+	player->input.rotate = rnd_in_range(rnd, S_PR_NONE, S_PR_RIGHT);
+	player->input.accelerate = rnd_in_range(rnd, S_PA_NONE, S_PA_REVERSE);
+	player->input.shoot = rnd_in_range(rnd, 0, 3) == 0;
+}
+
+void add_projectiles(World *world, int n_projectiles, RndState *rnd) {
+	// Top up the world to n_projectiles, since they expire and hit players. Shot by nobody, so that hits don't change the scores.
+	while (slot_map_size(&world->projectiles) < (size_t) n_projectiles) {
+		world_add_projectile(world, random_position(rnd), random_angle(rnd),
+		                     SLOT_HANDLE_NONE);
+	}
+}
+
+void sink_datagrams(const CpsockDatagram *datagrams, size_t n_datagrams) {
+	// Stand-in for the socket: copy every datagram out, like sendmmsg would.
+	static unsigned char buffer[65536]; // Bigger than any datagram.
+	for (size_t i_datagram = 0; i_datagram < n_datagrams; i_datagram++) {
+		const CpsockDatagram *datagram = &datagrams[i_datagram];
+		memcpy(buffer, datagram->prefix, datagram->prefix_size);
+		memcpy(buffer + datagram->prefix_size, datagram->data,
+		       datagram->size);
+	}
+}
+
+void send_to_players(World *world, Vector *packet, Vector *chunk_ends) {
+	// Build a datagram for every chunk of packet for every player, each with its own copy of the chunk's prefix with the per-recipient fields patched in (like send_sim_tick_packets), and send them to a null sink. This is the part of sending that grows with the number of players times the size of the tick.
+
+	typedef struct Prefix {
+		unsigned char data[SNAPSHOT_PACKET_PREFIX_SIZE];
+	} Prefix;
+	static bool buffers_initialized = false;
+	static Vector prefixes, datagrams;
+	if (!buffers_initialized) {
+		vector_init(&prefixes, sizeof(Prefix));
+		vector_init(&datagrams, sizeof(CpsockDatagram));
+		buffers_initialized = true;
+	}
+
+	size_t n_players = slot_map_size(&world->players);
+	vector_resize(&prefixes, n_players * chunk_ends->n_elems);
+	vector_resize(&datagrams, n_players * chunk_ends->n_elems);
+	size_t i_datagram = 0;
+	for (size_t i_player = 0; i_player < n_players; i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+		size_t chunk_begin = 0;
+		for (size_t i_chunk = 0; i_chunk < chunk_ends->n_elems; i_chunk++) {
+			size_t chunk_end = *(size_t *) vector_get(chunk_ends, i_chunk);
+			char *chunk = (char *) packet->array + chunk_begin;
+
+			Prefix *prefix = vector_get(&prefixes, i_datagram);
+			memcpy(prefix->data, chunk, sizeof(prefix->data));
+			snapshot_patch_recipient(prefix->data, player->id,
+			                         player->input_sequence_num);
+
+			CpsockDatagram *datagram = vector_get(&datagrams, i_datagram);
+			datagram->prefix = prefix->data;
+			datagram->prefix_size = sizeof(prefix->data);
+			datagram->data = chunk + sizeof(prefix->data);
+			datagram->size = chunk_end - chunk_begin - sizeof(prefix->data);
+
+			chunk_begin = chunk_end;
+			i_datagram++;
+		}
+	}
+	sink_datagrams(datagrams.array, datagrams.n_elems);
+}
+
+void bench_world(int n_players, int n_projectiles, int n_ticks) {
+	// Simulate a world of n_players players with scripted inputs and n_projectiles projectiles, timing every phase of every tick.
+
+	static Histogram histograms[N_BENCH_PHASES];
+	for (int phase = 0; phase < N_BENCH_PHASES; phase++)
+		histogram_clear(&histograms[phase]);
+
+	static bool buffers_initialized = false;
+	static SnapshotHistory history;
+	static Vector packet, chunk_ends;
+	if (!buffers_initialized) {
+		snapshot_history_init(&history);
+		vector_init(&packet, 1);
+		vector_init(&chunk_ends, sizeof(size_t));
+		buffers_initialized = true;
+	}
+	World world; // Never freed, since there are only a few.
+	world_init(&world);
+
+	SGameSettings settings;
+	settings.player_timeout = PLAYER_TIMEOUT;
+	settings.level_size = LEVEL_SIZE;
+	settings.fps = FPS;
+	settings.projectile_lifetime = PROJECTILE_LIFETIME;
+
+	RndState rnd = rnd_state_new(n_players * 100003ULL + n_projectiles + 1);
+	for (int i_player = 0; i_player < n_players; i_player++)
+		world_add_player(&world);
+
+	for (int i_tick = 0; i_tick < N_WARMUP_TICKS + n_ticks; i_tick++) {
+		if (i_tick % INPUT_SCRIPT_INTERVAL == 0) {
+			for (size_t i_player = 0;
+			     i_player < slot_map_size(&world.players); i_player++)
+				script_input(slot_map_at(&world.players, i_player), &rnd);
+		}
+		add_projectiles(&world, n_projectiles, &rnd);
+
+		Cptime times[8]; // Before, between and after the phases.
+		int i_time = 0;
+		times[i_time++] = cptime_time();
+		world_move(&world);
+		times[i_time++] = cptime_time();
+		world_detect_collisions(&world);
+		times[i_time++] = cptime_time();
+		world_spawn_position(&world);
+		times[i_time++] = cptime_time();
+		Snapshot *snapshot =
+			snapshot_history_add(&history, world.curr_tick);
+		world_capture(&world, snapshot);
+		times[i_time++] = cptime_time();
+		snapshot_encode(snapshot, NULL, &settings, MAX_DATAGRAM_SIZE,
+		                &packet, &chunk_ends);
+		times[i_time++] = cptime_time();
+		Snapshot *baseline =
+			snapshot_history_get(&history, world.curr_tick - 1);
+		if (baseline != NULL) {
+			snapshot_encode(snapshot, baseline, &settings,
+			                MAX_DATAGRAM_SIZE, &packet, &chunk_ends);
+		}
+		times[i_time++] = cptime_time();
+		send_to_players(&world, &packet, &chunk_ends); // The delta (if there's a baseline), which most players get.
+		times[i_time++] = cptime_time();
+
+		if (i_tick < N_WARMUP_TICKS)
+			continue;
+		histogram_record(&histograms[BENCH_MOVE],
+		                 elapsed_ns(&times[0], &times[1]));
+		histogram_record(&histograms[BENCH_COLLISIONS],
+		                 elapsed_ns(&times[1], &times[2]));
+		histogram_record(&histograms[BENCH_TICK],
+		                 elapsed_ns(&times[0], &times[2]));
+		histogram_record(&histograms[BENCH_SPAWN],
+		                 elapsed_ns(&times[2], &times[3]));
+		histogram_record(&histograms[BENCH_CAPTURE],
+		                 elapsed_ns(&times[3], &times[4]));
+		histogram_record(&histograms[BENCH_ENCODE_FULL],
+		                 elapsed_ns(&times[4], &times[5]));
+		if (baseline != NULL) {
+			histogram_record(&histograms[BENCH_ENCODE_DELTA],
+			                 elapsed_ns(&times[5], &times[6]));
+		}
+		histogram_record(&histograms[BENCH_SEND],
+		                 elapsed_ns(&times[6], &times[7]));
+	}
+
+	for (int phase = 0; phase < N_BENCH_PHASES; phase++) {
+		print_row(n_players, n_projectiles, BENCH_PHASE_NAMES[phase],
+		          &histograms[phase]);
+	}
+}
+
+
+/// Spawn selection.
+
+void bench_spawn(int n_players, int n_projectiles) {
+	// Time spawn selection among n_players players and n_projectiles projectiles placed at random, and check that it agrees with brute force.
+
+	static bool finder_initialized = false;
+	static SpawnFinder finder;
+	if (!finder_initialized) {
+		spawn_finder_init(&finder, LEVEL_SIZE, SPAWN_STEP);
+		finder_initialized = true;
+	}
+
+	Histogram histogram, histogram_brute;
+	histogram_clear(&histogram);
+	histogram_clear(&histogram_brute);
+	RndState rnd = rnd_state_new(n_players * 100003ULL + n_projectiles + 1);
+	for (int i_world = 0; i_world < N_SPAWN_WORLDS; i_world++) {
+		spawn_finder_clear(&finder);
+		for (int i_threat = 0; i_threat < n_players + n_projectiles;
+		     i_threat++)
+			spawn_finder_add_threat(&finder, random_position(&rnd));
+
+		Cptime start = cptime_time();
+		Vec2f position = spawn_finder_find(&finder);
+		Cptime end = cptime_time();
+		Vec2f position_brute = spawn_finder_find_brute_force(&finder);
+		Cptime end_brute = cptime_time();
+		histogram_record(&histogram, elapsed_ns(&start, &end));
+		histogram_record(&histogram_brute, elapsed_ns(&end, &end_brute));
+
+		if (position.x != position_brute.x || position.y != position_brute.y) {
+			fprintf(stderr, "ERROR: Spawn position search disagrees with"
+			        " brute force (%d players, %d projectiles).\n",
+			        n_players, n_projectiles);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	print_row(n_players, n_projectiles, "spawn_search", &histogram);
+	print_row(n_players, n_projectiles, "spawn_brute_force",
+	          &histogram_brute);
+}
+
+
+/// Projectile containers.
+// Projectiles expire in order of creation and hit things at random. Compare keeping them in a Vector (deleting from the middle) with a SlotMap plus a Ring of handles in order of creation (as in world.c).
+
+void remove_random_vector(Vector *projectiles, int n_removed, RndState *rnd) {
+	for (int i = 0; i < n_removed && projectiles->n_elems > 0; i++) {
+		vector_delete(projectiles,
+		              rnd_in_range(rnd, 0, projectiles->n_elems - 1));
+	}
+}
+
+void expire_vector(Vector *projectiles, int curr_tick) {
+	for (size_t i_projectile = 0; i_projectile < projectiles->n_elems;) {
+		Projectile *projectile = vector_get(projectiles, i_projectile);
+		if (curr_tick - projectile->creation_tick > PROJECTILE_LIFETIME)
+			vector_delete(projectiles, i_projectile);
+		else
+			i_projectile++;
+	}
+}
+
+void remove_random_slot_map(SlotMap *projectiles, int n_removed,
+                            RndState *rnd) {
+	for (int i = 0; i < n_removed && slot_map_size(projectiles) > 0; i++) {
+		size_t i_projectile =
+			rnd_in_range(rnd, 0, slot_map_size(projectiles) - 1);
+		slot_map_remove(projectiles,
+		                slot_map_handle_at(projectiles, i_projectile));
+	}
+}
+
+void expire_slot_map(SlotMap *projectiles, Ring *expiry, int curr_tick) {
+	while (ring_size(expiry) > 0) {
+		SlotHandle handle = *(SlotHandle *) ring_front(expiry);
+		Projectile *projectile = slot_map_get(projectiles, handle);
+		if (projectile != NULL) {
+			if (curr_tick - projectile->creation_tick <= PROJECTILE_LIFETIME)
+				break;
+			slot_map_remove(projectiles, handle);
+		}
+		ring_pop(expiry);
+	}
+}
+
+void bench_containers(int n_spawned_per_tick, int n_ticks) {
+	// Every tick, create n_spawned_per_tick projectiles, remove a tenth as many at random (hits) and expire the old ones, in both containers. Prints the number of projectiles alive at the end in the projectiles column.
+
+	Vector vector;
+	vector_init(&vector, sizeof(Projectile));
+	SlotMap slot_map;
+	slot_map_init(&slot_map, sizeof(Projectile));
+	Ring expiry;
+	ring_init(&expiry, sizeof(SlotHandle));
+
+	Histogram histogram_vector, histogram_slot_map;
+	histogram_clear(&histogram_vector);
+	histogram_clear(&histogram_slot_map);
+	RndState rnd_vector = rnd_state_new(n_spawned_per_tick + 1);
+	RndState rnd_slot_map = rnd_vector;
+	Projectile projectile;
+	projectile.heading = 0;
+	projectile.shooter = SLOT_HANDLE_NONE;
+
+	for (int tick = 0; tick < N_WARMUP_TICKS + n_ticks; tick++) {
+		projectile.creation_tick = tick;
+
+		Cptime start = cptime_time();
+		for (int i = 0; i < n_spawned_per_tick; i++)
+			vector_push(&vector, &projectile);
+		remove_random_vector(&vector, n_spawned_per_tick / 10, &rnd_vector);
+		expire_vector(&vector, tick);
+		Cptime end_vector = cptime_time();
+		for (int i = 0; i < n_spawned_per_tick; i++) {
+			SlotHandle handle = slot_map_insert(&slot_map, &projectile);
+			ring_push(&expiry, &handle);
+		}
+		remove_random_slot_map(&slot_map, n_spawned_per_tick / 10,
+		                       &rnd_slot_map);
+		expire_slot_map(&slot_map, &expiry, tick);
+		Cptime end_slot_map = cptime_time();
+
+		if (tick < N_WARMUP_TICKS)
+			continue;
+		histogram_record(&histogram_vector, elapsed_ns(&start, &end_vector));
+		histogram_record(&histogram_slot_map,
+		                 elapsed_ns(&end_vector, &end_slot_map));
+	}
+
+	print_row(0, vector.n_elems, "projectiles_vector", &histogram_vector);
+	print_row(0, slot_map_size(&slot_map), "projectiles_slot_map_ring",
+	          &histogram_slot_map);
+	vector_free(&vector);
+}
+
+
+/// Main.
+
+int main(int argc, char **argv) {
+	int n_ticks = DEFAULT_N_TICKS;
+	if (argc > 1)
+		n_ticks = atoi(argv[1]);
+	if (argc > 2 || n_ticks <= 0) {
+		fprintf(stderr, "Usage: %s [ticks per scenario]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("players,projectiles,phase,samples,mean_ns,p50_ns,p99_ns,max_ns\n");
+	for (size_t i_players = 0;
+	     i_players < sizeof(PLAYER_COUNTS) / sizeof(PLAYER_COUNTS[0]);
+	     i_players++) {
+		for (size_t i_projectiles = 0; i_projectiles
+		     < sizeof(PROJECTILE_COUNTS) / sizeof(PROJECTILE_COUNTS[0]);
+		     i_projectiles++) {
+			bench_world(PLAYER_COUNTS[i_players],
+			            PROJECTILE_COUNTS[i_projectiles], n_ticks);
+			bench_spawn(PLAYER_COUNTS[i_players],
+			            PROJECTILE_COUNTS[i_projectiles]);
+		}
+	}
+	for (size_t i_count = 0; i_count < sizeof(CONTAINER_SPAWN_COUNTS)
+	     / sizeof(CONTAINER_SPAWN_COUNTS[0]); i_count++)
+		bench_containers(CONTAINER_SPAWN_COUNTS[i_count], n_ticks);
+	return EXIT_SUCCESS;
+}
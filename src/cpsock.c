@@ -1,7 +1,16 @@
+#include "detect-platform.h"
+#if defined(PLATFORM_LINUX)
+	#define _GNU_SOURCE // For recvmmsg and sendmmsg.
+#endif
 #include "cpsock.h"
 #include <string.h>
 #include <stdbool.h>
-#include "detect-platform.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "cptime.h"
 
 bool cpsock_initialize() {
 #if defined(PLATFORM_WINDOWS)
@@ -37,6 +46,53 @@ void cpsock_close(int handle) {
 #endif
 }
 
+bool cpsock_set_reuse_port(int handle) {
+	// Let several sockets bind to the same port, with incoming datagrams spread between them by the kernel. Must be called before bind. Return value: false if it isn't supported (SO_REUSEPORT only balances the load like this on Linux).
+#if defined(PLATFORM_LINUX) && defined(SO_REUSEPORT)
+	int reuse_port = 1;
+	return setsockopt(handle, SOL_SOCKET, SO_REUSEPORT,
+	                  &reuse_port, sizeof(reuse_port)) == 0;
+#else
+	(void) handle;
+	return false;
+#endif
+}
+
+static bool cpsock_poll(int handle, short events, int timeout_ms) {
+	// Return value: whether one of the events happened before the timeout (-1 for none).
+	while (true) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+		struct pollfd poll_handle = { .fd = handle, .events = events };
+		int result = poll(&poll_handle, 1, timeout_ms);
+		if (result == -1 && errno == EINTR)
+			continue;
+#elif defined(PLATFORM_WINDOWS)
+		WSAPOLLFD poll_handle = { .fd = handle, .events = events };
+		int result = WSAPoll(&poll_handle, 1, timeout_ms);
+#endif
+		return result > 0;
+	}
+}
+
+bool cpsock_wait_readable(int handle) {
+	// Block until the socket has data to read. Return value: false on error.
+#if defined(PLATFORM_WINDOWS)
+	return cpsock_poll(handle, POLLRDNORM, -1);
+#else
+	return cpsock_poll(handle, POLLIN, -1);
+#endif
+}
+
+bool cpsock_wait_writable(int handle, double timeout) {
+	// Block until the socket has room to send, for at most timeout seconds. Return value: false on timeout or error.
+	int timeout_ms = (timeout <= 0) ? 0 : (int) ceil(timeout * 1000);
+#if defined(PLATFORM_WINDOWS)
+	return cpsock_poll(handle, POLLWRNORM, timeout_ms);
+#else
+	return cpsock_poll(handle, POLLOUT, timeout_ms);
+#endif
+}
+
 #define CPSOCK_SIZEOF_MEMBER(type, member) \
 	(sizeof(((type *) NULL)->member))
 
@@ -78,6 +134,41 @@ in_port_t cpsock_ip_port(const struct sockaddr *address) {
 	}
 }
 
+CpsockAddressKey cpsock_address_key(const struct sockaddr *address) {
+	CpsockAddressKey key;
+	memset(&key, 0, sizeof(key)); // Including padding.
+
+	switch(address->sa_family) {
+	case AF_INET: {
+		struct sockaddr_in *addr_in = (struct sockaddr_in *) address;
+		key.family = AF_INET;
+		memcpy(key.address, &addr_in->sin_addr.s_addr,
+		       sizeof(addr_in->sin_addr.s_addr));
+		key.port = addr_in->sin_port;
+		break;
+	}
+	case AF_INET6: {
+		struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *) address;
+		static const uint8_t V4_MAPPED_PREFIX[12] =
+			{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+		const uint8_t *bytes = addr_in6->sin6_addr.s6_addr;
+		if (memcmp(bytes, V4_MAPPED_PREFIX, sizeof(V4_MAPPED_PREFIX)) == 0) {
+			key.family = AF_INET;
+			memcpy(key.address, bytes + sizeof(V4_MAPPED_PREFIX), 4);
+		} else {
+			key.family = AF_INET6;
+			memcpy(key.address, bytes, sizeof(key.address));
+		}
+		key.port = addr_in6->sin6_port;
+		break;
+	}
+	default:
+		break;
+	}
+
+	return key;
+}
+
 const char *cpsock_ip_to_string(const struct sockaddr *address,
                                 char *string, size_t string_size) {
 	// Return value: string on success, NULL on failure.
@@ -98,3 +189,272 @@ const char *cpsock_ip_to_string(const struct sockaddr *address,
 		return NULL;
 	}
 }
+
+bool cpsock_ip_from_string(const char *string,
+                           struct sockaddr_storage *address) {
+	// Parse an IPv4 or IPv6 address (with port 0). Return value: false if it's neither.
+
+	memset(address, 0, sizeof(*address));
+	struct sockaddr_in *addr_in = (struct sockaddr_in *) address;
+	if (inet_pton(AF_INET, string, &addr_in->sin_addr) == 1) {
+		addr_in->sin_family = AF_INET;
+		return true;
+	}
+	struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *) address;
+	if (inet_pton(AF_INET6, string, &addr_in6->sin6_addr) == 1) {
+		addr_in6->sin6_family = AF_INET6;
+		return true;
+	}
+	return false;
+}
+
+
+// Atomic, since receiver and network threads use it concurrently and any of them may turn batching off. Relaxed, since it doesn't guard other data.
+#if defined(PLATFORM_LINUX)
+static atomic_bool batching_enabled = true;
+#else
+static atomic_bool batching_enabled = false;
+#endif
+
+void cpsock_stats_add(CpsockStats *total, const CpsockStats *stats) {
+	total->n_receive_syscalls += stats->n_receive_syscalls;
+	total->n_send_syscalls += stats->n_send_syscalls;
+	total->n_datagrams_received += stats->n_datagrams_received;
+	total->n_datagrams_sent += stats->n_datagrams_sent;
+	total->n_bytes_received += stats->n_bytes_received;
+	total->n_bytes_sent += stats->n_bytes_sent;
+	total->n_send_errors += stats->n_send_errors;
+	total->n_send_retries += stats->n_send_retries;
+	total->n_send_timeouts += stats->n_send_timeouts;
+}
+
+bool cpsock_set_batching(bool enabled) {
+	// Return value: whether batching is now enabled (false if it was requested but isn't supported on this platform).
+#if defined(PLATFORM_LINUX)
+	atomic_store_explicit(&batching_enabled, enabled,
+	                      memory_order_relaxed);
+#else
+	(void) enabled;
+#endif
+	return atomic_load_explicit(&batching_enabled, memory_order_relaxed);
+}
+
+bool cpsock_batching(void) {
+	return atomic_load_explicit(&batching_enabled, memory_order_relaxed);
+}
+
+bool cpsock_would_block(void) {
+	// Whether the last failed call on this thread failed only because the (non-blocking) socket wasn't ready.
+#if defined(PLATFORM_WINDOWS)
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static int cpsock_receive_unbatched(int handle, CpsockDatagram *datagrams,
+                                    int n_datagrams, CpsockStats *stats) {
+	int n_received = 0;
+	while (n_received < n_datagrams) {
+		CpsockDatagram *datagram = &datagrams[n_received];
+		socklen_t address_size = sizeof(datagram->address);
+		stats->n_receive_syscalls++;
+		ssize_t size = recvfrom(
+			handle, (char *) datagram->data, datagram->size, 0,
+			(struct sockaddr *) &datagram->address, &address_size);
+		if (size < 0) {
+			if (n_received == 0 && !cpsock_would_block())
+				return -1;
+			break;
+		}
+
+		datagram->size = size;
+		stats->n_bytes_received += size;
+		n_received++;
+	}
+
+	stats->n_datagrams_received += n_received;
+	return n_received;
+}
+
+static int cpsock_send_unbatched(int handle, CpsockDatagram *datagrams,
+                                 int n_datagrams, CpsockStats *stats) {
+	// Buffer for concatenating prefix and data, extended if necessary.
+	static _Thread_local char *buffer = NULL;
+	static _Thread_local size_t buffer_size = 0;
+
+	int n_sent = 0;
+	for (; n_sent < n_datagrams; n_sent++) {
+		CpsockDatagram *datagram = &datagrams[n_sent];
+		const char *packet = datagram->data;
+		size_t packet_size = datagram->prefix_size + datagram->size;
+		if (datagram->prefix_size > 0) {
+			if (packet_size > buffer_size) {
+				buffer_size = packet_size;
+				free(buffer);
+				buffer = malloc(buffer_size);
+			}
+			memcpy(buffer, datagram->prefix, datagram->prefix_size);
+			memcpy(buffer + datagram->prefix_size,
+			       datagram->data, datagram->size);
+			packet = buffer;
+		}
+
+		stats->n_send_syscalls++;
+		ssize_t n_sent_bytes = sendto(
+			handle, packet, packet_size, 0,
+			(struct sockaddr *) &datagram->address,
+			sizeof(datagram->address));
+		if (n_sent_bytes < 0 || (size_t) n_sent_bytes != packet_size) {
+			if (n_sent_bytes >= 0 || !cpsock_would_block())
+				stats->n_send_errors++;
+			break;
+		}
+		stats->n_bytes_sent += n_sent_bytes;
+	}
+
+	stats->n_datagrams_sent += n_sent;
+	return (n_sent == 0 && n_datagrams > 0) ? -1 : n_sent;
+}
+
+int cpsock_receive_batch(int handle, CpsockDatagram *datagrams,
+                         int n_datagrams, CpsockStats *stats) {
+	// Receive up to n_datagrams datagrams without blocking (the socket should be non-blocking). The data and size of each datagram must be set to its buffer beforehand.
+	// Return value: number of datagrams received (0 if there were none pending), -1 on error.
+
+#if defined(PLATFORM_LINUX)
+	if (atomic_load_explicit(&batching_enabled, memory_order_relaxed)) {
+		struct mmsghdr messages[CPSOCK_MAX_BATCH];
+		struct iovec iovecs[CPSOCK_MAX_BATCH];
+		if (n_datagrams > CPSOCK_MAX_BATCH)
+			n_datagrams = CPSOCK_MAX_BATCH;
+
+		memset(messages, 0, n_datagrams * sizeof(messages[0]));
+		for (int i = 0; i < n_datagrams; i++) {
+			iovecs[i].iov_base = datagrams[i].data;
+			iovecs[i].iov_len = datagrams[i].size;
+			messages[i].msg_hdr.msg_name = &datagrams[i].address;
+			messages[i].msg_hdr.msg_namelen = sizeof(datagrams[i].address);
+			messages[i].msg_hdr.msg_iov = &iovecs[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		stats->n_receive_syscalls++;
+		int n_received = recvmmsg(handle, messages, n_datagrams,
+		                          MSG_DONTWAIT, NULL);
+		if (n_received < 0) {
+			if (errno == ENOSYS) { // Old kernel.
+				atomic_store_explicit(&batching_enabled, false,
+				                      memory_order_relaxed);
+				return cpsock_receive_unbatched(
+					handle, datagrams, n_datagrams, stats);
+			}
+			return cpsock_would_block() ? 0 : -1;
+		}
+
+		for (int i = 0; i < n_received; i++) {
+			datagrams[i].size = messages[i].msg_len;
+			stats->n_bytes_received += messages[i].msg_len;
+		}
+		stats->n_datagrams_received += n_received;
+		return n_received;
+	}
+#endif
+
+	return cpsock_receive_unbatched(handle, datagrams, n_datagrams, stats);
+}
+
+int cpsock_send_batch(int handle, CpsockDatagram *datagrams,
+                      int n_datagrams, CpsockStats *stats) {
+	// Send datagrams (each one consisting of its prefix followed by its data).
+	// Return value: number of datagrams sent (stops at the first one that failed), -1 if none could be sent.
+
+#if defined(PLATFORM_LINUX)
+	if (atomic_load_explicit(&batching_enabled, memory_order_relaxed)) {
+		struct mmsghdr messages[CPSOCK_MAX_BATCH];
+		struct iovec iovecs[CPSOCK_MAX_BATCH][2];
+
+		int n_sent = 0;
+		while (n_sent < n_datagrams) {
+			int n_batch = n_datagrams - n_sent;
+			if (n_batch > CPSOCK_MAX_BATCH)
+				n_batch = CPSOCK_MAX_BATCH;
+
+			memset(messages, 0, n_batch * sizeof(messages[0]));
+			for (int i = 0; i < n_batch; i++) {
+				CpsockDatagram *datagram = &datagrams[n_sent + i];
+				int n_iovecs = 0;
+				if (datagram->prefix_size > 0) {
+					iovecs[i][n_iovecs].iov_base = (void *) datagram->prefix;
+					iovecs[i][n_iovecs].iov_len = datagram->prefix_size;
+					n_iovecs++;
+				}
+				iovecs[i][n_iovecs].iov_base = datagram->data;
+				iovecs[i][n_iovecs].iov_len = datagram->size;
+				n_iovecs++;
+
+				messages[i].msg_hdr.msg_name = &datagram->address;
+				messages[i].msg_hdr.msg_namelen = sizeof(datagram->address);
+				messages[i].msg_hdr.msg_iov = iovecs[i];
+				messages[i].msg_hdr.msg_iovlen = n_iovecs;
+			}
+
+			stats->n_send_syscalls++;
+			int n_batch_sent = sendmmsg(handle, messages, n_batch, 0);
+			if (n_batch_sent < 0) {
+				if (errno == ENOSYS) { // Old kernel.
+					atomic_store_explicit(&batching_enabled, false,
+					                      memory_order_relaxed);
+					int n_rest_sent = cpsock_send_unbatched(
+						handle, datagrams + n_sent,
+						n_datagrams - n_sent, stats);
+					return n_rest_sent < 0 ? n_sent : n_sent + n_rest_sent;
+				}
+				if (!cpsock_would_block())
+					stats->n_send_errors++;
+				break;
+			}
+
+			for (int i = 0; i < n_batch_sent; i++)
+				stats->n_bytes_sent += messages[i].msg_len;
+			stats->n_datagrams_sent += n_batch_sent;
+			n_sent += n_batch_sent;
+			if (n_batch_sent < n_batch)
+				break;
+		}
+
+		return (n_sent == 0 && n_datagrams > 0) ? -1 : n_sent;
+	}
+#endif
+
+	return cpsock_send_unbatched(handle, datagrams, n_datagrams, stats);
+}
+
+int cpsock_send_all(int handle, CpsockDatagram *datagrams, int n_datagrams,
+                    double timeout, CpsockStats *stats) {
+	// Send datagrams like cpsock_send_batch, but when the socket's buffer is full, wait for it to drain and retry, for at most timeout seconds in total. Datagrams left over after that are dropped (counted in n_send_timeouts), as are ones that fail for other reasons (n_send_errors).
+	// Return value: number of datagrams sent.
+
+	Cptime start = cptime_time();
+	int n_sent = 0;
+	int n_done = 0;
+	while (n_done < n_datagrams) {
+		int n_batch_sent = cpsock_send_batch(
+			handle, datagrams + n_done, n_datagrams - n_done, stats);
+		if (n_batch_sent > 0) {
+			n_sent += n_batch_sent;
+			n_done += n_batch_sent;
+		} else if (!cpsock_would_block()) {
+			n_done++; // Skip the datagram that failed.
+		} else {
+			Cptime now = cptime_time();
+			double time_left = timeout - cptime_elapsed(&start, &now);
+			if (time_left <= 0 || !cpsock_wait_writable(handle, time_left)) {
+				stats->n_send_timeouts += n_datagrams - n_done;
+				break;
+			}
+			stats->n_send_retries++;
+		}
+	}
+	return n_sent;
+}
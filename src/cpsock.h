@@ -2,6 +2,7 @@
 
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include "detect-platform.h"
 
 #if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
@@ -10,6 +11,7 @@
 	#include <netinet/in.h>
 	#include <fcntl.h>
 	#include <arpa/inet.h>
+	#include <poll.h>
 #elif defined(PLATFORM_WINDOWS)
 	#pragma comment(lib, "wsock32.lib")
 	#pragma comment(lib, "ws2_32.lib")
@@ -30,11 +32,75 @@ bool cpsock_set_nonblocking(int handle);
 
 void cpsock_close(int handle);
 
+bool cpsock_set_reuse_port(int handle);
+
+bool cpsock_wait_readable(int handle);
+
+bool cpsock_wait_writable(int handle, double timeout);
+
+bool cpsock_would_block(void);
+
 bool cpsock_ip_equal(
 	const struct sockaddr *a, const struct sockaddr *b);
 
 in_port_t cpsock_ip_port(const struct sockaddr *address);
 
+// (Family, address, port) of an IP socket address, with IPv4-mapped IPv6 addresses converted to IPv4. Suitable for hashing and comparing with memcmp.
+typedef struct CpsockAddressKey {
+	uint8_t family; // AF_INET, AF_INET6 or 0 (unknown).
+	uint8_t address[16]; // IPv4 addresses use the first 4 bytes.
+	uint16_t port; // In network byte order.
+} CpsockAddressKey;
+
+CpsockAddressKey cpsock_address_key(const struct sockaddr *address);
+
 enum { CPSOCK_IP_TO_STRING_LEN = INET6_ADDRSTRLEN };
 const char *cpsock_ip_to_string(
 	const struct sockaddr *address, char *string, size_t string_size);
+
+bool cpsock_ip_from_string(const char *string,
+                           struct sockaddr_storage *address);
+
+
+/// Batched datagram I/O.
+// On Linux, this uses recvmmsg/sendmmsg to move many datagrams per syscall. Elsewhere (or if batching is disabled or unsupported by the kernel), it falls back to one recvfrom/sendto per datagram.
+
+enum { CPSOCK_MAX_BATCH = 64 }; // Max datagrams per syscall.
+
+typedef struct CpsockDatagram {
+	struct sockaddr_storage address;
+
+	// Sent before data (sending only, may be NULL). Lets many datagrams share the same data with different prefixes.
+	const void *prefix;
+	size_t prefix_size;
+
+	void *data;
+	size_t size; // When receiving: buffer size before the call, datagram size after it.
+} CpsockDatagram;
+
+typedef struct CpsockStats {
+	unsigned long n_receive_syscalls;
+	unsigned long n_send_syscalls;
+	unsigned long n_datagrams_received;
+	unsigned long n_datagrams_sent;
+	unsigned long long n_bytes_received;
+	unsigned long long n_bytes_sent;
+	unsigned long n_send_errors; // Datagrams that failed to send.
+	unsigned long n_send_retries; // Times we waited for a full send buffer to drain.
+	unsigned long n_send_timeouts; // Datagrams dropped because the send buffer stayed full.
+} CpsockStats;
+
+void cpsock_stats_add(CpsockStats *total, const CpsockStats *stats);
+
+bool cpsock_set_batching(bool enabled);
+
+bool cpsock_batching(void);
+
+int cpsock_receive_batch(int handle, CpsockDatagram *datagrams,
+                         int n_datagrams, CpsockStats *stats);
+
+int cpsock_send_batch(int handle, CpsockDatagram *datagrams,
+                      int n_datagrams, CpsockStats *stats);
+
+int cpsock_send_all(int handle, CpsockDatagram *datagrams, int n_datagrams,
+                    double timeout, CpsockStats *stats);
@@ -0,0 +1,108 @@
+#include "cpthread.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include "detect-platform.h"
+
+// The native thread functions have different signatures, so threads start in a trampoline that calls the real function.
+typedef struct CpthreadStart {
+	CpthreadFunction function;
+	void *arg;
+} CpthreadStart;
+
+static void cpthread_run(CpthreadStart *start) {
+	CpthreadStart copy = *start;
+	free(start);
+	copy.function(copy.arg);
+}
+
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+static void *cpthread_trampoline(void *start) {
+	cpthread_run(start);
+	return NULL;
+}
+#elif defined(PLATFORM_WINDOWS)
+static DWORD WINAPI cpthread_trampoline(LPVOID start) {
+	cpthread_run(start);
+	return 0;
+}
+#endif
+
+bool cpthread_create(Cpthread *thread, CpthreadFunction function, void *arg) {
+	CpthreadStart *start = malloc(sizeof(*start));
+	if (start == NULL)
+		return false;
+	start->function = function;
+	start->arg = arg;
+
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	bool success = pthread_create(thread, NULL, cpthread_trampoline, start) == 0;
+#elif defined(PLATFORM_WINDOWS)
+	*thread = CreateThread(NULL, 0, cpthread_trampoline, start, 0, NULL);
+	bool success = *thread != NULL;
+#endif
+
+	if (!success)
+		free(start);
+	return success;
+}
+
+void cpthread_join(Cpthread thread) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_join(thread, NULL);
+#elif defined(PLATFORM_WINDOWS)
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#endif
+}
+
+
+/// Synchronization.
+
+void cpthread_mutex_init(CpthreadMutex *mutex) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_mutex_init(mutex, NULL);
+#elif defined(PLATFORM_WINDOWS)
+	InitializeCriticalSection(mutex);
+#endif
+}
+
+void cpthread_mutex_lock(CpthreadMutex *mutex) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_mutex_lock(mutex);
+#elif defined(PLATFORM_WINDOWS)
+	EnterCriticalSection(mutex);
+#endif
+}
+
+void cpthread_mutex_unlock(CpthreadMutex *mutex) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_mutex_unlock(mutex);
+#elif defined(PLATFORM_WINDOWS)
+	LeaveCriticalSection(mutex);
+#endif
+}
+
+void cpthread_cond_init(CpthreadCond *cond) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_cond_init(cond, NULL);
+#elif defined(PLATFORM_WINDOWS)
+	InitializeConditionVariable(cond);
+#endif
+}
+
+void cpthread_cond_wait(CpthreadCond *cond, CpthreadMutex *mutex) {
+	// May wake up spuriously, so always call it in a loop that checks the condition.
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_cond_wait(cond, mutex);
+#elif defined(PLATFORM_WINDOWS)
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+#endif
+}
+
+void cpthread_cond_broadcast(CpthreadCond *cond) {
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	pthread_cond_broadcast(cond);
+#elif defined(PLATFORM_WINDOWS)
+	WakeAllConditionVariable(cond);
+#endif
+}
@@ -0,0 +1,38 @@
+// Crossplatform threads.
+
+#pragma once
+#include <stdbool.h>
+#include "detect-platform.h"
+
+#if defined(PLATFORM_UNIX) || defined(PLATFORM_MAC)
+	#include <pthread.h>
+	typedef pthread_t Cpthread;
+	typedef pthread_mutex_t CpthreadMutex;
+	typedef pthread_cond_t CpthreadCond;
+#elif defined(PLATFORM_WINDOWS)
+	#include <Windows.h>
+	typedef HANDLE Cpthread;
+	typedef CRITICAL_SECTION CpthreadMutex;
+	typedef CONDITION_VARIABLE CpthreadCond;
+#endif
+
+typedef void (*CpthreadFunction)(void *arg);
+
+bool cpthread_create(Cpthread *thread, CpthreadFunction function, void *arg);
+
+void cpthread_join(Cpthread thread);
+
+
+/// Synchronization.
+
+void cpthread_mutex_init(CpthreadMutex *mutex);
+
+void cpthread_mutex_lock(CpthreadMutex *mutex);
+
+void cpthread_mutex_unlock(CpthreadMutex *mutex);
+
+void cpthread_cond_init(CpthreadCond *cond);
+
+void cpthread_cond_wait(CpthreadCond *cond, CpthreadMutex *mutex);
+
+void cpthread_cond_broadcast(CpthreadCond *cond);
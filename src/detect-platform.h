@@ -8,4 +8,7 @@
 	#define PLATFORM_MAC
 #else
 	#define PLATFORM_UNIX
+	#if defined(__linux__)
+		#define PLATFORM_LINUX // In addition to PLATFORM_UNIX.
+	#endif
 #endif
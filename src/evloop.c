@@ -0,0 +1,175 @@
+#include "evloop.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include "cptime.h"
+#include "detect-platform.h"
+
+#if defined(PLATFORM_LINUX)
+	#include <unistd.h>
+	#include <sys/epoll.h>
+	#include <sys/timerfd.h>
+	#include <time.h>
+#endif
+
+#if defined(PLATFORM_LINUX)
+static bool event_loop_init_epoll(EventLoop *loop) {
+	// Return value: false if epoll or timerfd couldn't be set up, in which case nothing is left open.
+
+	loop->epoll_handle = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_handle == -1)
+		return false;
+	loop->timer_handle = timerfd_create(CLOCK_MONOTONIC,
+	                                    TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->timer_handle == -1) {
+		close(loop->epoll_handle);
+		return false;
+	}
+
+	// Absolute, periodic deadlines, so that the schedule doesn't drift with the time it takes to run a tick.
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long interval_ns = (long) (loop->tick_interval * 1e+9);
+	struct itimerspec schedule;
+	schedule.it_interval.tv_sec = interval_ns / 1000000000;
+	schedule.it_interval.tv_nsec = interval_ns % 1000000000;
+	schedule.it_value.tv_sec = now.tv_sec + schedule.it_interval.tv_sec;
+	schedule.it_value.tv_nsec = now.tv_nsec + schedule.it_interval.tv_nsec;
+	if (schedule.it_value.tv_nsec >= 1000000000) {
+		schedule.it_value.tv_sec++;
+		schedule.it_value.tv_nsec -= 1000000000;
+	}
+
+	struct epoll_event socket_event = { .events = EPOLLIN };
+	socket_event.data.fd = loop->socket_handle;
+	struct epoll_event timer_event = { .events = EPOLLIN };
+	timer_event.data.fd = loop->timer_handle;
+
+	if (timerfd_settime(loop->timer_handle, TFD_TIMER_ABSTIME,
+	                    &schedule, NULL) == -1
+	    || (loop->socket_handle != -1
+	        && epoll_ctl(loop->epoll_handle, EPOLL_CTL_ADD,
+	                     loop->socket_handle, &socket_event) == -1)
+	    || epoll_ctl(loop->epoll_handle, EPOLL_CTL_ADD,
+	                 loop->timer_handle, &timer_event) == -1) {
+		close(loop->timer_handle);
+		close(loop->epoll_handle);
+		return false;
+	}
+	return true;
+}
+
+static int event_loop_wait_epoll(EventLoop *loop, unsigned long *n_ticks) {
+	enum { MAX_EVENTS = 2 };
+	struct epoll_event events[MAX_EVENTS];
+
+	while (true) {
+		int n_events = epoll_wait(loop->epoll_handle, events, MAX_EVENTS, -1);
+		if (n_events == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		int flags = 0;
+		for (int i_event = 0; i_event < n_events; i_event++) {
+			if (events[i_event].data.fd == loop->socket_handle) {
+				flags |= EVENT_LOOP_READABLE;
+			} else {
+				// The timer holds the number of deadlines since the last read.
+				uint64_t n_expirations;
+				if (read(loop->timer_handle, &n_expirations,
+				         sizeof(n_expirations)) == sizeof(n_expirations)
+				    && n_expirations > 0) {
+					*n_ticks = n_expirations;
+					flags |= EVENT_LOOP_TICK;
+				}
+			}
+		}
+		if (flags != 0)
+			return flags;
+	}
+}
+#endif
+
+void event_loop_init(EventLoop *loop, int socket_handle,
+                     double tick_interval, bool use_epoll) {
+	// If use_epoll is false or epoll isn't available, the loop falls back to sleeping until the next tick and then reading the socket. socket_handle may be -1 to only wait for ticks.
+
+	loop->socket_handle = socket_handle;
+	loop->watching_socket = socket_handle != -1;
+	loop->tick_interval = tick_interval;
+	loop->using_epoll = false;
+	loop->epoll_handle = -1;
+	loop->timer_handle = -1;
+	loop->start_time = cptime_time();
+	loop->n_ticks_elapsed = 0;
+
+#if defined(PLATFORM_LINUX)
+	if (use_epoll)
+		loop->using_epoll = event_loop_init_epoll(loop);
+#else
+	(void) use_epoll;
+#endif
+}
+
+void event_loop_close(EventLoop *loop) {
+#if defined(PLATFORM_LINUX)
+	if (loop->using_epoll) {
+		close(loop->timer_handle);
+		close(loop->epoll_handle);
+	}
+#endif
+	loop->using_epoll = false;
+}
+
+const char *event_loop_implementation(const EventLoop *loop) {
+	return loop->using_epoll ? "epoll + timerfd" : "nanosleep";
+}
+
+static int event_loop_wait_sleep(EventLoop *loop, unsigned long *n_ticks) {
+	// Deadlines are multiples of tick_interval since start_time, so the schedule doesn't drift.
+	Cptime now = cptime_time();
+	double elapsed = cptime_elapsed(&loop->start_time, &now);
+	double next_tick = (loop->n_ticks_elapsed + 1) * loop->tick_interval;
+	if (elapsed < next_tick) {
+		cptime_sleep(next_tick - elapsed);
+		now = cptime_time();
+		elapsed = cptime_elapsed(&loop->start_time, &now);
+	}
+
+	unsigned long n_ticks_elapsed =
+		(unsigned long) (elapsed / loop->tick_interval);
+	if (n_ticks_elapsed <= loop->n_ticks_elapsed) // Woken up a bit early.
+		n_ticks_elapsed = loop->n_ticks_elapsed + 1;
+	*n_ticks = n_ticks_elapsed - loop->n_ticks_elapsed;
+	loop->n_ticks_elapsed = n_ticks_elapsed;
+	return loop->watching_socket
+		? EVENT_LOOP_READABLE | EVENT_LOOP_TICK : EVENT_LOOP_TICK;
+}
+
+void event_loop_watch_socket(EventLoop *loop, bool watch) {
+	// Stop (or resume) reporting the socket as readable, e.g. to leave datagrams in its buffer until the next tick. Ticks are reported either way.
+	if (loop->socket_handle == -1 || loop->watching_socket == watch)
+		return;
+	loop->watching_socket = watch;
+#if defined(PLATFORM_LINUX)
+	if (loop->using_epoll) {
+		struct epoll_event socket_event = { .events = watch ? EPOLLIN : 0 };
+		socket_event.data.fd = loop->socket_handle;
+		epoll_ctl(loop->epoll_handle, EPOLL_CTL_MOD, loop->socket_handle,
+		          &socket_event);
+	}
+#endif
+}
+
+int event_loop_wait(EventLoop *loop, unsigned long *n_ticks) {
+	// Block until there's something to do. Return value: a combination of EVENT_LOOP_* flags, or -1 on error. If EVENT_LOOP_TICK is set, *n_ticks is the number of deadlines that have passed since the last tick (more than 1 if we're falling behind).
+
+	*n_ticks = 0;
+#if defined(PLATFORM_LINUX)
+	if (loop->using_epoll)
+		return event_loop_wait_epoll(loop, n_ticks);
+#endif
+	return event_loop_wait_sleep(loop, n_ticks);
+}
@@ -0,0 +1,38 @@
+// Waiting until a socket becomes readable or a fixed-rate tick is due.
+
+#pragma once
+#include <stdbool.h>
+#include <time.h>
+#include "cptime.h"
+
+// Flags returned by event_loop_wait.
+enum {
+	EVENT_LOOP_READABLE = 1 << 0, // The socket may have datagrams to read.
+	EVENT_LOOP_TICK = 1 << 1, // At least one tick deadline has passed.
+};
+
+typedef struct EventLoop {
+	int socket_handle;
+	bool watching_socket; // See event_loop_watch_socket.
+	double tick_interval; // Seconds.
+	bool using_epoll;
+
+	// epoll (Linux only).
+	int epoll_handle;
+	int timer_handle; // timerfd that expires on every tick deadline.
+
+	// Sleeping fallback.
+	Cptime start_time;
+	unsigned long n_ticks_elapsed; // Deadlines already reported.
+} EventLoop;
+
+void event_loop_init(EventLoop *loop, int socket_handle,
+                     double tick_interval, bool use_epoll);
+
+void event_loop_close(EventLoop *loop);
+
+const char *event_loop_implementation(const EventLoop *loop);
+
+void event_loop_watch_socket(EventLoop *loop, bool watch);
+
+int event_loop_wait(EventLoop *loop, unsigned long *n_ticks);
@@ -0,0 +1,116 @@
+#include "grid.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <assert.h>
+#include "vector.h"
+
+typedef struct GridEntry {
+	int cell;
+	uint32_t item;
+} GridEntry;
+
+void grid_init(Grid *grid, SVectorInt level_size, float min_cell_size) {
+	// Cells are at least min_cell_size wide and high, and tile the level exactly (so that wrapping around the edges works).
+	assert(level_size.x > 0 && level_size.y > 0 && min_cell_size > 0);
+
+	grid->level_size = level_size;
+	grid->n_columns = fmax(1, floor(level_size.x / min_cell_size));
+	grid->n_rows = fmax(1, floor(level_size.y / min_cell_size));
+	grid->cell_width = (float) level_size.x / grid->n_columns;
+	grid->cell_height = (float) level_size.y / grid->n_rows;
+
+	vector_init(&grid->entries, sizeof(GridEntry));
+	vector_init(&grid->cell_starts, sizeof(size_t));
+	vector_init(&grid->items, sizeof(uint32_t));
+	vector_resize(&grid->cell_starts, grid->n_columns * grid->n_rows + 1);
+	grid_clear(grid);
+	grid_finish(grid);
+}
+
+void grid_clear(Grid *grid) {
+	vector_resize(&grid->entries, 0);
+}
+
+static int wrap_index(int index, int n) {
+	index %= n;
+	return (index < 0) ? index + n : index;
+}
+
+static int grid_column(Grid *grid, float x) {
+	return wrap_index((int) floor(x / grid->cell_width), grid->n_columns);
+}
+
+static int grid_row(Grid *grid, float y) {
+	return wrap_index((int) floor(y / grid->cell_height), grid->n_rows);
+}
+
+void grid_insert(Grid *grid, uint32_t item, Vec2f position) {
+	GridEntry entry;
+	entry.cell = grid_row(grid, position.y) * grid->n_columns
+		+ grid_column(grid, position.x);
+	entry.item = item;
+	vector_push(&grid->entries, &entry);
+}
+
+void grid_finish(Grid *grid) {
+	// Sort the inserted items by cell (counting sort). Items in the same cell stay in insertion order.
+
+	size_t n_cells = grid->n_columns * grid->n_rows;
+	size_t *cell_starts = grid->cell_starts.array;
+	for (size_t i_cell = 0; i_cell <= n_cells; i_cell++)
+		cell_starts[i_cell] = 0;
+
+	GridEntry *entries = grid->entries.array;
+	size_t n_entries = grid->entries.n_elems;
+	for (size_t i_entry = 0; i_entry < n_entries; i_entry++)
+		cell_starts[entries[i_entry].cell + 1]++;
+	for (size_t i_cell = 0; i_cell < n_cells; i_cell++)
+		cell_starts[i_cell + 1] += cell_starts[i_cell];
+
+	// Use cell_starts as insertion cursors, shifting them by one cell in the process.
+	vector_resize(&grid->items, n_entries);
+	uint32_t *items = grid->items.array;
+	for (size_t i_entry = 0; i_entry < n_entries; i_entry++)
+		items[cell_starts[entries[i_entry].cell]++] = entries[i_entry].item;
+	for (size_t i_cell = n_cells; i_cell > 0; i_cell--)
+		cell_starts[i_cell] = cell_starts[i_cell - 1];
+	cell_starts[0] = 0;
+}
+
+void grid_query_cells(Grid *grid, Vec2f position, float radius,
+                      Vector *cells) {
+	// Replace the contents of cells (an array of int) with the indices of all cells that can contain objects at most radius away from position (wrapping around the level edges). Each cell is listed once.
+
+	assert(cells->elem_size == sizeof(int));
+	vector_resize(cells, 0);
+
+	// Pad the radius slightly, so that rounding errors can't make us miss objects right at its edge.
+	radius += 0.01;
+
+	int first_column = (int) floor((position.x - radius) / grid->cell_width);
+	int last_column = (int) floor((position.x + radius) / grid->cell_width);
+	int first_row = (int) floor((position.y - radius) / grid->cell_height);
+	int last_row = (int) floor((position.y + radius) / grid->cell_height);
+	if (last_column - first_column >= grid->n_columns)
+		last_column = first_column + grid->n_columns - 1;
+	if (last_row - first_row >= grid->n_rows)
+		last_row = first_row + grid->n_rows - 1;
+
+	// Once clamped to the size of the grid, the ranges don't wrap around onto themselves, so no cell is listed twice.
+	for (int row = first_row; row <= last_row; row++) {
+		for (int column = first_column; column <= last_column; column++) {
+			int cell = wrap_index(row, grid->n_rows) * grid->n_columns
+				+ wrap_index(column, grid->n_columns);
+			vector_push(cells, &cell);
+		}
+	}
+}
+
+const uint32_t *grid_cell_items(Grid *grid, int cell, size_t *n_items) {
+	// Return value: items in the cell (in insertion order), with their number in n_items. Valid until the next grid_finish.
+	size_t *cell_starts = grid->cell_starts.array;
+	*n_items = cell_starts[cell + 1] - cell_starts[cell];
+	return (uint32_t *) grid->items.array + cell_starts[cell];
+}
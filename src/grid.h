@@ -0,0 +1,33 @@
+// Uniform grid over a toroidal level, for finding nearby objects.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "serialization.h"
+#include "vec2f.h"
+#include "vector.h"
+
+typedef struct Grid {
+	SVectorInt level_size;
+	int n_columns;
+	int n_rows;
+	float cell_width;
+	float cell_height;
+
+	Vector entries; // Array of (cell, item) pairs, as inserted.
+	Vector cell_starts; // Array of size_t: for each cell, index of its first item (plus one past the end).
+	Vector items; // Array of uint32_t, sorted by cell.
+} Grid;
+
+void grid_init(Grid *grid, SVectorInt level_size, float min_cell_size);
+
+void grid_clear(Grid *grid);
+
+void grid_insert(Grid *grid, uint32_t item, Vec2f position);
+
+void grid_finish(Grid *grid);
+
+void grid_query_cells(Grid *grid, Vec2f position, float radius,
+                      Vector *cells);
+
+const uint32_t *grid_cell_items(Grid *grid, int cell, size_t *n_items);
@@ -0,0 +1,84 @@
+#include "histogram.h"
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define HISTOGRAM_MAX_VALUE ((UINT64_C(1) << HISTOGRAM_MAX_BITS) - 1)
+
+static int highest_bit(uint64_t value) {
+	// Return value: index of the highest set bit (value must not be 0).
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(value);
+#else
+	int bit = 0;
+	while (value >>= 1)
+		bit++;
+	return bit;
+#endif
+}
+
+static int bucket_index(uint64_t value) {
+	if (value < 2 * HISTOGRAM_SUB_BUCKETS)
+		return value;
+	// The top HISTOGRAM_SUB_BUCKET_BITS + 1 bits of the value (which start with a 1) pick the bucket within its power of two.
+	int shift = highest_bit(value) - HISTOGRAM_SUB_BUCKET_BITS;
+	return shift * HISTOGRAM_SUB_BUCKETS + (int) (value >> shift);
+}
+
+static uint64_t bucket_highest_value(int index) {
+	if (index < 2 * HISTOGRAM_SUB_BUCKETS)
+		return index;
+	int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub_bucket = index - shift * HISTOGRAM_SUB_BUCKETS;
+	return ((sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_clear(Histogram *histogram) {
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void histogram_record(Histogram *histogram, uint64_t value) {
+	if (value > HISTOGRAM_MAX_VALUE)
+		value = HISTOGRAM_MAX_VALUE;
+	histogram->counts[bucket_index(value)]++;
+	histogram->n_values++;
+	histogram->sum += value;
+	if (value > histogram->max)
+		histogram->max = value;
+}
+
+void histogram_add(Histogram *dest, const Histogram *src) {
+	for (int i_bucket = 0; i_bucket < HISTOGRAM_N_BUCKETS; i_bucket++)
+		dest->counts[i_bucket] += src->counts[i_bucket];
+	dest->n_values += src->n_values;
+	dest->sum += src->sum;
+	if (src->max > dest->max)
+		dest->max = src->max;
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double percentile) {
+	// Return value: the smallest recorded value (rounded up to the end of its bucket) that at least percentile % of values are at most, 0 if there are none.
+
+	assert(percentile >= 0 && percentile <= 100);
+	if (histogram->n_values == 0)
+		return 0;
+
+	uint64_t rank = ceil(percentile / 100 * histogram->n_values);
+	if (rank == 0)
+		rank = 1;
+	uint64_t n_seen = 0;
+	for (int i_bucket = 0; i_bucket < HISTOGRAM_N_BUCKETS; i_bucket++) {
+		n_seen += histogram->counts[i_bucket];
+		if (n_seen >= rank) {
+			uint64_t value = bucket_highest_value(i_bucket);
+			return (value < histogram->max) ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+double histogram_mean(const Histogram *histogram) {
+	return (histogram->n_values == 0)
+		? 0 : (double) histogram->sum / histogram->n_values;
+}
@@ -0,0 +1,29 @@
+// Histograms of non-negative integers (like durations in nanoseconds) in fixed memory, for percentiles.
+// Buckets are log-linear, like in HdrHistogram: values below 2 * HISTOGRAM_SUB_BUCKETS get a bucket each, and every power of two above that is split into HISTOGRAM_SUB_BUCKETS buckets. So percentiles are accurate to about 1 / HISTOGRAM_SUB_BUCKETS (3%), and recording a value only takes a few instructions.
+
+#pragma once
+#include <stdint.h>
+
+enum { HISTOGRAM_SUB_BUCKET_BITS = 5 };
+enum { HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS };
+enum { HISTOGRAM_MAX_BITS = 40 }; // Bigger values (over 18 minutes in nanoseconds) are counted as 2^40 - 1.
+enum { HISTOGRAM_N_BUCKETS =
+	(HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1)
+	* HISTOGRAM_SUB_BUCKETS };
+
+typedef struct Histogram {
+	uint64_t n_values;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t counts[HISTOGRAM_N_BUCKETS];
+} Histogram;
+
+void histogram_clear(Histogram *histogram);
+
+void histogram_record(Histogram *histogram, uint64_t value);
+
+void histogram_add(Histogram *dest, const Histogram *src);
+
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);
+
+double histogram_mean(const Histogram *histogram);
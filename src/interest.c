@@ -0,0 +1,284 @@
+#include "interest.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "grid.h"
+#include "serialization.h"
+#include "snapshot.h"
+#include "vec2f.h"
+#include "vector.h"
+
+// Kinds of entities in the index, stored in the top bits of grid items.
+enum { INTEREST_PLAYER, INTEREST_EXPLOSION, INTEREST_PROJECTILE,
+       INTEREST_N_KINDS };
+enum { INTEREST_KIND_SHIFT = 30 };
+#define INTEREST_INDEX_MASK ((UINT32_C(1) << INTEREST_KIND_SHIFT) - 1)
+
+
+/// Looking up entities.
+
+static SEntityId entity_id(Vector *elems, int kind, size_t i_elem) {
+	void *elem = vector_get(elems, i_elem);
+	switch (kind) {
+	case INTEREST_PLAYER:
+		return ((SPlayer *) elem)->id;
+	case INTEREST_EXPLOSION:
+		return ((SExplosion *) elem)->id;
+	default:
+		return ((SProjectile *) elem)->id;
+	}
+}
+
+static Vec2f entity_position(Vector *elems, int kind, size_t i_elem,
+                             SVectorInt level_size) {
+	void *elem = vector_get(elems, i_elem);
+	SPosition position;
+	switch (kind) {
+	case INTEREST_PLAYER:
+		position = ((SPlayer *) elem)->position;
+		break;
+	case INTEREST_EXPLOSION:
+		position = ((SExplosion *) elem)->position;
+		break;
+	default:
+		position = ((SProjectile *) elem)->position;
+		break;
+	}
+	return s_position_decode(position, level_size);
+}
+
+static Vector *snapshot_entities(Snapshot *snapshot, int kind) {
+	switch (kind) {
+	case INTEREST_PLAYER:
+		return &snapshot->players;
+	case INTEREST_EXPLOSION:
+		return &snapshot->explosions;
+	default:
+		return &snapshot->projectiles;
+	}
+}
+
+static Vector *view_ids(InterestView *view, int kind) {
+	switch (kind) {
+	case INTEREST_PLAYER:
+		return &view->player_ids;
+	case INTEREST_EXPLOSION:
+		return &view->explosion_ids;
+	default:
+		return &view->projectile_ids;
+	}
+}
+
+static bool find_by_id(Vector *elems, int kind, SEntityId id,
+                       size_t *i_found) {
+	// Binary search in an array of entities sorted by ID.
+	size_t low = 0;
+	size_t high = elems->n_elems;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		SEntityId middle_id = entity_id(elems, kind, middle);
+		if (middle_id == id) {
+			*i_found = middle;
+			return true;
+		} else if (middle_id < id) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return false;
+}
+
+static bool contains_id(Vector *ids, SEntityId id) {
+	size_t low = 0;
+	size_t high = ids->n_elems;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		SEntityId middle_id = *(SEntityId *) vector_get(ids, middle);
+		if (middle_id == id)
+			return true;
+		else if (middle_id < id)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return false;
+}
+
+static int compare_indices(const void *a, const void *b) {
+	uint32_t index_a = *(const uint32_t *) a;
+	uint32_t index_b = *(const uint32_t *) b;
+	return (index_a > index_b) - (index_a < index_b);
+}
+
+
+/// Index.
+
+void interest_index_init(InterestIndex *index, SVectorInt level_size,
+                         float radius, float hysteresis) {
+	assert(radius > 0 && hysteresis >= 0);
+	index->radius = radius;
+	index->hysteresis = hysteresis;
+	index->sequence_num = 0;
+	// Half the query radius is a good trade-off between the number of cells we look at and how much of them is outside the circle.
+	grid_init(&index->grid, level_size, (radius + hysteresis) / 2);
+}
+
+void interest_index_build(InterestIndex *index, Snapshot *snapshot) {
+	grid_clear(&index->grid);
+	for (int kind = 0; kind < INTEREST_N_KINDS; kind++) {
+		Vector *elems = snapshot_entities(snapshot, kind);
+		assert(elems->n_elems <= INTEREST_INDEX_MASK);
+		for (size_t i_elem = 0; i_elem < elems->n_elems; i_elem++) {
+			uint32_t item = ((uint32_t) kind << INTEREST_KIND_SHIFT) | i_elem;
+			grid_insert(&index->grid, item, entity_position(
+				elems, kind, i_elem, index->grid.level_size));
+		}
+	}
+	grid_finish(&index->grid);
+	index->sequence_num = snapshot->sequence_num;
+}
+
+
+/// Per-client history.
+
+void interest_history_init(InterestHistory *history) {
+	history->last_sequence_num = 0;
+	for (int i_view = 0; i_view < SNAPSHOT_HISTORY_LEN; i_view++) {
+		InterestView *view = &history->views[i_view];
+		view->sequence_num = 0;
+		for (int kind = 0; kind < INTEREST_N_KINDS; kind++)
+			vector_init(view_ids(view, kind), sizeof(SEntityId));
+	}
+}
+
+void interest_history_free(InterestHistory *history) {
+	for (int i_view = 0; i_view < SNAPSHOT_HISTORY_LEN; i_view++) {
+		for (int kind = 0; kind < INTEREST_N_KINDS; kind++)
+			vector_free(view_ids(&history->views[i_view], kind));
+	}
+}
+
+static InterestView *interest_history_get(InterestHistory *history,
+                                          SSequenceNum sequence_num) {
+	// Return value: the view of the given snapshot, NULL if it's no longer (or was never) in the history.
+	if (sequence_num == 0)
+		return NULL;
+	InterestView *view =
+		&history->views[sequence_num % SNAPSHOT_HISTORY_LEN];
+	return (view->sequence_num == sequence_num) ? view : NULL;
+}
+
+
+/// Culling.
+
+void interest_cull(InterestIndex *index, Snapshot *snapshot,
+                   InterestHistory *history, SPlayerId viewer_id,
+                   Snapshot *view) {
+	// Fill view with the entities of snapshot (which the index must have been built from) that the viewer should be sent, and record them in its history. Costs a neighbour query around the viewer's player rather than a pass over the whole snapshot.
+
+	assert(index->sequence_num == snapshot->sequence_num);
+	assert(snapshot->sequence_num > history->last_sequence_num);
+
+	static _Thread_local bool scratch_initialized = false;
+	static _Thread_local Vector cells;
+	static _Thread_local Vector selected[INTEREST_N_KINDS]; // Indices into the snapshot's arrays.
+	if (!scratch_initialized) {
+		vector_init(&cells, sizeof(int));
+		for (int kind = 0; kind < INTEREST_N_KINDS; kind++)
+			vector_init(&selected[kind], sizeof(uint32_t));
+		scratch_initialized = true;
+	}
+
+	InterestView *previous =
+		interest_history_get(history, history->last_sequence_num);
+	InterestView *current =
+		&history->views[snapshot->sequence_num % SNAPSHOT_HISTORY_LEN];
+	if (previous == current) // Sent a whole history ago, so it's gone anyway.
+		previous = NULL;
+
+	size_t i_viewer;
+	bool viewer_found = find_by_id(&snapshot->players, INTEREST_PLAYER,
+	                               viewer_id, &i_viewer);
+	assert(viewer_found);
+	(void) viewer_found;
+	SVectorInt level_size = index->grid.level_size;
+	Vec2f center = entity_position(&snapshot->players, INTEREST_PLAYER,
+	                               i_viewer, level_size);
+
+	float outer_radius = index->radius + index->hysteresis;
+	float radius_sqr = index->radius * index->radius;
+	float outer_radius_sqr = outer_radius * outer_radius;
+
+	for (int kind = 0; kind < INTEREST_N_KINDS; kind++)
+		vector_resize(&selected[kind], 0);
+
+	grid_query_cells(&index->grid, center, outer_radius, &cells);
+	for (size_t i_cell = 0; i_cell < cells.n_elems; i_cell++) {
+		size_t n_items;
+		const uint32_t *items = grid_cell_items(
+			&index->grid, *(int *) vector_get(&cells, i_cell), &n_items);
+		for (size_t i_item = 0; i_item < n_items; i_item++) {
+			int kind = items[i_item] >> INTEREST_KIND_SHIFT;
+			uint32_t i_elem = items[i_item] & INTEREST_INDEX_MASK;
+			Vector *elems = snapshot_entities(snapshot, kind);
+			float distance_sqr = vec2f_wrapped_distance_sqr(
+				center, entity_position(elems, kind, i_elem, level_size),
+				level_size);
+
+			bool visible = distance_sqr <= radius_sqr
+				|| (distance_sqr <= outer_radius_sqr && previous != NULL
+				    && contains_id(view_ids(previous, kind),
+				                   entity_id(elems, kind, i_elem)));
+			if (visible)
+				vector_push(&selected[kind], &i_elem);
+		}
+	}
+
+	// Cells come in no particular order, but the snapshot's arrays are sorted by ID, so sorting the indices keeps the view sorted too.
+	snapshot_clear(view, snapshot->sequence_num);
+	current->sequence_num = snapshot->sequence_num;
+	for (int kind = 0; kind < INTEREST_N_KINDS; kind++) {
+		Vector *elems = snapshot_entities(snapshot, kind);
+		Vector *view_elems = snapshot_entities(view, kind);
+		Vector *ids = view_ids(current, kind);
+		qsort(selected[kind].array, selected[kind].n_elems,
+		      sizeof(uint32_t), compare_indices);
+		vector_resize(ids, 0);
+		for (size_t i = 0; i < selected[kind].n_elems; i++) {
+			uint32_t i_elem = *(uint32_t *) vector_get(&selected[kind], i);
+			SEntityId id = entity_id(elems, kind, i_elem);
+			vector_push(view_elems, vector_get(elems, i_elem));
+			vector_push(ids, &id);
+		}
+	}
+	history->last_sequence_num = snapshot->sequence_num;
+}
+
+bool interest_baseline(InterestHistory *history, Snapshot *baseline,
+                       Snapshot *view) {
+	// Fill view with the part of baseline that was sent to the client (by interest_cull). Return value: false if the history doesn't have it anymore.
+
+	InterestView *sent = interest_history_get(history, baseline->sequence_num);
+	if (sent == NULL)
+		return false;
+
+	snapshot_clear(view, baseline->sequence_num);
+	for (int kind = 0; kind < INTEREST_N_KINDS; kind++) {
+		Vector *elems = snapshot_entities(baseline, kind);
+		Vector *ids = view_ids(sent, kind);
+		for (size_t i_id = 0; i_id < ids->n_elems; i_id++) {
+			size_t i_elem;
+			bool found = find_by_id(elems, kind,
+			                        *(SEntityId *) vector_get(ids, i_id),
+			                        &i_elem);
+			assert(found); // It was taken from this very snapshot.
+			(void) found;
+			vector_push(snapshot_entities(view, kind),
+			            vector_get(elems, i_elem));
+		}
+	}
+	return true;
+}
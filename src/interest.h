@@ -0,0 +1,48 @@
+// Area-of-interest culling: sending each client only the entities near its player.
+// Entities are sent within radius of the player. Ones the client already has stay until they're radius + hysteresis away, so that they don't flicker in and out of view at the edge. Since clients then see different parts of a snapshot, we remember what each of them was sent, and delta-compress against that instead of the whole baseline.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "grid.h"
+#include "serialization.h"
+#include "snapshot.h"
+#include "vector.h"
+
+// Entities of one snapshot by position.
+typedef struct InterestIndex {
+	float radius;
+	float hysteresis;
+	SSequenceNum sequence_num; // Of the snapshot it was built from, 0 if none.
+	Grid grid; // Items are entity kinds (in the top bits) and indices into the snapshot's arrays.
+} InterestIndex;
+
+// IDs of the entities sent to a client in one snapshot.
+typedef struct InterestView {
+	SSequenceNum sequence_num; // 0 if unused.
+	Vector player_ids; // Array of SEntityId, sorted.
+	Vector explosion_ids; // Array of SEntityId, sorted.
+	Vector projectile_ids; // Array of SEntityId, sorted.
+} InterestView;
+
+// What a client was sent in recent snapshots.
+typedef struct InterestHistory {
+	SSequenceNum last_sequence_num; // Of the newest view, 0 if none.
+	InterestView views[SNAPSHOT_HISTORY_LEN];
+} InterestHistory;
+
+void interest_index_init(InterestIndex *index, SVectorInt level_size,
+                         float radius, float hysteresis);
+
+void interest_index_build(InterestIndex *index, Snapshot *snapshot);
+
+void interest_history_init(InterestHistory *history);
+
+void interest_history_free(InterestHistory *history);
+
+void interest_cull(InterestIndex *index, Snapshot *snapshot,
+                   InterestHistory *history, SPlayerId viewer_id,
+                   Snapshot *view);
+
+bool interest_baseline(InterestHistory *history, Snapshot *baseline,
+                       Snapshot *view);
@@ -0,0 +1,177 @@
+#include "kinematics.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// SIMD implementations are compiled with function-specific target attributes and chosen at runtime, so the binary still runs on CPUs without AVX2 (or SSE2, on 32-bit x86).
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define KINEMATICS_X86
+	#include <immintrin.h>
+#endif
+
+enum { KINEMATICS_INITIAL_N_ALLOCATED = 16 };
+
+static void kinematics_allocate(Kinematics *kinematics, size_t n_allocated) {
+	kinematics->n_allocated = n_allocated;
+	kinematics->x = realloc(kinematics->x, n_allocated * sizeof(float));
+	kinematics->y = realloc(kinematics->y, n_allocated * sizeof(float));
+	kinematics->velocity_x =
+		realloc(kinematics->velocity_x, n_allocated * sizeof(float));
+	kinematics->velocity_y =
+		realloc(kinematics->velocity_y, n_allocated * sizeof(float));
+}
+
+void kinematics_init(Kinematics *kinematics) {
+	kinematics->x = NULL;
+	kinematics->y = NULL;
+	kinematics->velocity_x = NULL;
+	kinematics->velocity_y = NULL;
+	kinematics->n_elems = 0;
+	kinematics_allocate(kinematics, KINEMATICS_INITIAL_N_ALLOCATED);
+}
+
+void kinematics_push(Kinematics *kinematics, Vec2f position, Vec2f velocity) {
+	if (kinematics->n_elems == kinematics->n_allocated)
+		kinematics_allocate(kinematics, kinematics->n_allocated * 2);
+
+	size_t i_elem = kinematics->n_elems++;
+	kinematics->x[i_elem] = position.x;
+	kinematics->y[i_elem] = position.y;
+	kinematics->velocity_x[i_elem] = velocity.x;
+	kinematics->velocity_y[i_elem] = velocity.y;
+}
+
+void kinematics_remove(Kinematics *kinematics, size_t i_elem) {
+	// Remove an element by moving the last one into its place (like slot_map_remove, so that both can be indexed the same way).
+	assert(i_elem < kinematics->n_elems);
+	size_t i_last = --kinematics->n_elems;
+	kinematics->x[i_elem] = kinematics->x[i_last];
+	kinematics->y[i_elem] = kinematics->y[i_last];
+	kinematics->velocity_x[i_elem] = kinematics->velocity_x[i_last];
+	kinematics->velocity_y[i_elem] = kinematics->velocity_y[i_last];
+}
+
+void kinematics_copy(Kinematics *dest, Kinematics *src) {
+	// Make dest (initialized) a copy of src.
+	if (dest->n_allocated < src->n_elems)
+		kinematics_allocate(dest, src->n_allocated);
+	dest->n_elems = src->n_elems;
+	memcpy(dest->x, src->x, src->n_elems * sizeof(float));
+	memcpy(dest->y, src->y, src->n_elems * sizeof(float));
+	memcpy(dest->velocity_x, src->velocity_x, src->n_elems * sizeof(float));
+	memcpy(dest->velocity_y, src->velocity_y, src->n_elems * sizeof(float));
+}
+
+Vec2f kinematics_position(Kinematics *kinematics, size_t i_elem) {
+	assert(i_elem < kinematics->n_elems);
+	Vec2f result;
+	result.x = kinematics->x[i_elem];
+	result.y = kinematics->y[i_elem];
+	return result;
+}
+
+Vec2f kinematics_velocity(Kinematics *kinematics, size_t i_elem) {
+	assert(i_elem < kinematics->n_elems);
+	Vec2f result;
+	result.x = kinematics->velocity_x[i_elem];
+	result.y = kinematics->velocity_y[i_elem];
+	return result;
+}
+
+
+/// Integration.
+// Every implementation computes exactly the same thing as vec2f_wrap_position(vec2f_add(position, velocity), limits), but without branches: the wrapping offset is selected with a comparison mask.
+
+static void integrate_scalar(float *position, const float *velocity,
+                             size_t begin, size_t end, float limit) {
+	for (size_t i = begin; i < end; i++) {
+		float p = position[i] + velocity[i];
+		float below = (p < 0) ? limit : 0;
+		float above = (p > limit) ? limit : 0;
+		position[i] = p + below - above;
+	}
+}
+
+#if defined(KINEMATICS_X86)
+__attribute__((target("sse2")))
+static void integrate_sse2(float *position, const float *velocity,
+                           size_t n, float limit) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 limits = _mm_set1_ps(limit);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 p = _mm_add_ps(_mm_loadu_ps(position + i),
+		                      _mm_loadu_ps(velocity + i));
+		__m128 below = _mm_and_ps(_mm_cmplt_ps(p, zero), limits);
+		__m128 above = _mm_and_ps(_mm_cmpgt_ps(p, limits), limits);
+		_mm_storeu_ps(position + i, _mm_sub_ps(_mm_add_ps(p, below), above));
+	}
+	integrate_scalar(position, velocity, i, n, limit);
+}
+
+__attribute__((target("avx2")))
+static void integrate_avx2(float *position, const float *velocity,
+                           size_t n, float limit) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 limits = _mm256_set1_ps(limit);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 p = _mm256_add_ps(_mm256_loadu_ps(position + i),
+		                         _mm256_loadu_ps(velocity + i));
+		__m256 below = _mm256_and_ps(
+			_mm256_cmp_ps(p, zero, _CMP_LT_OQ), limits);
+		__m256 above = _mm256_and_ps(
+			_mm256_cmp_ps(p, limits, _CMP_GT_OQ), limits);
+		_mm256_storeu_ps(position + i,
+		                 _mm256_sub_ps(_mm256_add_ps(p, below), above));
+	}
+	integrate_scalar(position, velocity, i, n, limit);
+}
+#endif
+
+static void integrate_portable(float *position, const float *velocity,
+                               size_t n, float limit) {
+	integrate_scalar(position, velocity, 0, n, limit);
+}
+
+typedef void (*IntegrateFunction)(float *position, const float *velocity,
+                                  size_t n, float limit);
+
+static IntegrateFunction integrate_function = NULL;
+static const char *integrate_function_name = NULL;
+
+static void kinematics_choose_implementation(void) {
+	integrate_function = integrate_portable;
+	integrate_function_name = "scalar";
+#if defined(KINEMATICS_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		integrate_function = integrate_avx2;
+		integrate_function_name = "AVX2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		integrate_function = integrate_sse2;
+		integrate_function_name = "SSE2";
+	}
+#endif
+}
+
+void kinematics_integrate(Kinematics *kinematics, SVectorInt limits) {
+	// Add velocities to positions and wrap the positions around the edges of a toroidal world (as in vec2f_wrap_position).
+	if (integrate_function == NULL)
+		kinematics_choose_implementation();
+
+	integrate_function(kinematics->x, kinematics->velocity_x,
+	                   kinematics->n_elems, limits.x);
+	integrate_function(kinematics->y, kinematics->velocity_y,
+	                   kinematics->n_elems, limits.y);
+}
+
+const char *kinematics_implementation(void) {
+	// Return value: name of the SIMD instruction set used by kinematics_integrate.
+	if (integrate_function == NULL)
+		kinematics_choose_implementation();
+	return integrate_function_name;
+}
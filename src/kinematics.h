@@ -0,0 +1,31 @@
+// Positions and velocities of many objects, stored as a structure of arrays so that they can be integrated with SIMD instructions.
+
+#pragma once
+#include <stddef.h>
+#include "serialization.h"
+#include "vec2f.h"
+
+typedef struct Kinematics {
+	float *x;
+	float *y;
+	float *velocity_x;
+	float *velocity_y;
+	size_t n_elems;
+	size_t n_allocated;
+} Kinematics;
+
+void kinematics_init(Kinematics *kinematics);
+
+void kinematics_push(Kinematics *kinematics, Vec2f position, Vec2f velocity);
+
+void kinematics_remove(Kinematics *kinematics, size_t i_elem);
+
+void kinematics_copy(Kinematics *dest, Kinematics *src);
+
+Vec2f kinematics_position(Kinematics *kinematics, size_t i_elem);
+
+Vec2f kinematics_velocity(Kinematics *kinematics, size_t i_elem);
+
+void kinematics_integrate(Kinematics *kinematics, SVectorInt limits);
+
+const char *kinematics_implementation(void);
@@ -0,0 +1,759 @@
+// Load generator: a swarm of bot clients for a server on this machine, which reports how well the server keeps up with them.
+// Bots connect with the handshake, send inputs at a fixed rate (random ones, or a script) and acknowledge every simulation tick they receive in full, like real clients (but without decoding the ticks). Every received tick is checked with s_array_valid. The server tells players apart by their address, so with IPv4 on Linux, many bots share each socket and send from their own addresses in 127.0.0.0/8 (picked per datagram with IP_PKTINFO). Otherwise, each bot gets a socket of its own. Only servers at loopback addresses are accepted. Usage: see print_usage.
+
+#include "detect-platform.h"
+#if defined(PLATFORM_LINUX)
+	#define _GNU_SOURCE // For IP_PKTINFO.
+#endif
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "addrmap.h"
+#include "cpsock.h"
+#include "cptime.h"
+#include "histogram.h"
+#include "rnd.h"
+#include "serialization.h"
+
+const char *const DEFAULT_SERVER_ADDRESS = "127.0.0.1";
+const unsigned short DEFAULT_SERVER_PORT = 6642;
+const int DEFAULT_N_BOTS = 1000;
+const int DEFAULT_N_SOCKETS = 4; // Shared by the bots (if possible).
+const double DEFAULT_INPUT_RATE = 30; // Inputs per second per bot.
+const double DEFAULT_DURATION = 10; // Seconds.
+const double DEFAULT_RAMP_UP = 1; // Seconds over which the bots start connecting.
+
+const double CONNECT_RETRY_INTERVAL = 0.2; // Seconds without a reply before a bot resends its S_PT_CONNECT.
+const double RANDOM_INPUT_INTERVAL = 0.5; // Mean seconds between changes of a random input.
+const double SCRIPT_STEP_DURATION = 0.5; // Seconds per step of INPUT_SCRIPT.
+const double REPORT_INTERVAL = 1; // Seconds between progress lines.
+const int SOCKET_BUFFER_SIZE = 4 * 1024 * 1024; // Bytes, so that ticks sent to all bots at once fit.
+enum { MAX_RECEIVED_SIZE = 65536 }; // Bigger than any datagram, so that oversized ones are counted and not truncated.
+enum { MAX_SENT_PACKET_SIZE = sizeof(SPlayerInputPacket) };
+enum { SIM_TICK_PREFIX_SIZE =
+	sizeof(SPacketHeader) + sizeof(SSimulationTickPacket) };
+
+// Each bot starts at a different step, so that they don't all do the same.
+const SPlayerInput INPUT_SCRIPT[] = {
+	{S_PA_FORWARD, S_PR_NONE, 0},
+	{S_PA_FORWARD, S_PR_LEFT, 1},
+	{S_PA_NONE, S_PR_LEFT, 1},
+	{S_PA_FORWARD, S_PR_RIGHT, 0},
+	{S_PA_REVERSE, S_PR_NONE, 1},
+	{S_PA_NONE, S_PR_RIGHT, 1},
+	{S_PA_FORWARD, S_PR_NONE, 1},
+	{S_PA_NONE, S_PR_NONE, 0},
+};
+enum { INPUT_SCRIPT_LENGTH = sizeof(INPUT_SCRIPT) / sizeof(INPUT_SCRIPT[0]) };
+
+
+/// Options.
+
+enum InputMode { INPUT_MODE_RANDOM, INPUT_MODE_SCRIPT };
+
+typedef struct Options {
+	const char *server_address;
+	unsigned short server_port;
+	int n_bots;
+	int n_sockets;
+	double input_rate;
+	double duration;
+	double ramp_up;
+	SArenaId arena_id;
+	enum InputMode input_mode;
+} Options;
+
+void print_usage(const char *program) {
+	fprintf(stderr,
+	        "Usage: %s [-a address] [-p port] [-n bots] [-s sockets]"
+	        " [-r inputs per second] [-d seconds] [-w ramp-up seconds]"
+	        " [-A arena] [-i random|script]\n"
+	        "The address must be a loopback one (127.0.0.0/8 or ::1)."
+	        " Defaults: -a %s -p %d -n %d -s %d -r %g -d %g -w %g -A 0"
+	        " -i random.\n",
+	        program, DEFAULT_SERVER_ADDRESS, DEFAULT_SERVER_PORT,
+	        DEFAULT_N_BOTS, DEFAULT_N_SOCKETS, DEFAULT_INPUT_RATE,
+	        DEFAULT_DURATION, DEFAULT_RAMP_UP);
+}
+
+bool parse_options(int argc, char **argv, Options *options) {
+	// Return value: false if the options are invalid.
+
+	options->server_address = DEFAULT_SERVER_ADDRESS;
+	options->server_port = DEFAULT_SERVER_PORT;
+	options->n_bots = DEFAULT_N_BOTS;
+	options->n_sockets = DEFAULT_N_SOCKETS;
+	options->input_rate = DEFAULT_INPUT_RATE;
+	options->duration = DEFAULT_DURATION;
+	options->ramp_up = DEFAULT_RAMP_UP;
+	options->arena_id = 0;
+	options->input_mode = INPUT_MODE_RANDOM;
+
+	int option;
+	while ((option = getopt(argc, argv, "a:p:n:s:r:d:w:A:i:h")) != -1) {
+		switch (option) {
+		case 'a': options->server_address = optarg; break;
+		case 'p': options->server_port = atoi(optarg); break;
+		case 'n': options->n_bots = atoi(optarg); break;
+		case 's': options->n_sockets = atoi(optarg); break;
+		case 'r': options->input_rate = atof(optarg); break;
+		case 'd': options->duration = atof(optarg); break;
+		case 'w': options->ramp_up = atof(optarg); break;
+		case 'A': options->arena_id = atoi(optarg); break;
+		case 'i':
+			if (strcmp(optarg, "random") == 0)
+				options->input_mode = INPUT_MODE_RANDOM;
+			else if (strcmp(optarg, "script") == 0)
+				options->input_mode = INPUT_MODE_SCRIPT;
+			else
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	return optind == argc && options->server_port != 0
+		&& options->n_bots > 0 && options->n_sockets > 0
+		&& options->input_rate > 0 && options->duration > 0
+		&& options->ramp_up >= 0;
+}
+
+
+/// Bots.
+
+enum BotState {
+	BOT_WAITING, // For its turn to connect, during the ramp-up.
+	BOT_CONNECTING,
+	BOT_PLAYING,
+};
+
+typedef struct Bot {
+	int socket; // Index into sockets.
+	struct sockaddr_storage local_address; // That the server sees it at.
+	enum BotState state;
+	double start_time; // Seconds since the start, when it starts connecting.
+	double connect_time; // When it last sent an S_PT_CONNECT.
+	SCookie cookie;
+	SSessionToken session;
+
+	SPlayerInput input;
+	double input_change_time; // When a random input changes next.
+	SSequenceNum input_sequence_num;
+	SSequenceNum ack_sim_tick_sequence_num; // Newest tick received in full.
+
+	// The newest tick that chunks were received of.
+	bool have_tick;
+	SSequenceNum tick_sequence_num;
+	uint16_t n_chunks;
+	uint16_t n_chunks_received;
+	size_t tick_size; // Bytes in all its chunks so far.
+	double tick_arrival_time; // Of its first chunk.
+} Bot;
+
+typedef struct LoadStats {
+	unsigned long n_connects_sent;
+	unsigned long n_inputs_sent;
+	unsigned long n_send_errors;
+	unsigned long n_challenges;
+	unsigned long n_sessions;
+
+	unsigned long n_datagrams_received;
+	unsigned long long n_bytes_received;
+	unsigned long n_foreign; // Not from the server, or not to a bot.
+	unsigned long n_invalid; // Bad header, size, type or arrays.
+	unsigned long n_bad_baselines; // Deltas against ticks that the bot didn't acknowledge.
+
+	unsigned long n_ticks_complete;
+	unsigned long n_ticks_incomplete; // A newer tick arrived before all chunks.
+	unsigned long n_ticks_missed; // Gaps in sequence numbers: lost, or skipped by an overloaded server.
+	unsigned long n_late_chunks; // Of ticks older than the newest one.
+
+	Histogram connect_us; // From the first S_PT_CONNECT to the session.
+	Histogram interval_us; // Between the first chunks of consecutive ticks.
+	Histogram jitter_us; // Difference between the interval and the server's tick period times the number of ticks.
+	Histogram datagram_size;
+	Histogram tick_size; // All chunks of a complete tick.
+} LoadStats;
+
+Options options;
+Bot *bots;
+int n_bots;
+int *sockets;
+int n_sockets;
+bool shared_sockets; // Whether bots share sockets with IP_PKTINFO.
+AddrMap bots_by_address; // Keys of local_address of bots.
+struct sockaddr_storage server_address;
+socklen_t server_address_len;
+CpsockAddressKey server_key;
+RndState rnd;
+LoadStats stats;
+
+void random_input(SPlayerInput *input) {
+	input->accelerate = rnd_in_range(&rnd, S_PA_NONE, S_PA_REVERSE);
+	input->rotate = rnd_in_range(&rnd, S_PR_NONE, S_PR_RIGHT);
+	input->shoot = rnd_in_range(&rnd, 0, 1);
+}
+
+void update_input(Bot *bot, int i_bot, double now) {
+	if (options.input_mode == INPUT_MODE_SCRIPT) {
+		int step = (int) (now / SCRIPT_STEP_DURATION) + i_bot;
+		bot->input = INPUT_SCRIPT[step % INPUT_SCRIPT_LENGTH];
+	} else if (now >= bot->input_change_time) {
+		random_input(&bot->input);
+		double uniform = (rnd_next(&rnd) >> 11) * (1.0 / 9007199254740992.0);
+		bot->input_change_time =
+			now + 2 * RANDOM_INPUT_INTERVAL * uniform;
+	}
+}
+
+
+/// Sockets.
+
+bool address_is_loopback(const struct sockaddr *address) {
+	CpsockAddressKey key = cpsock_address_key(address);
+	static const uint8_t IPV6_LOOPBACK[16] = {[15] = 1};
+	if (key.family == AF_INET)
+		return key.address[0] == 127;
+	if (key.family == AF_INET6)
+		return memcmp(key.address, IPV6_LOOPBACK, sizeof(key.address)) == 0;
+	return false;
+}
+
+void set_port(struct sockaddr_storage *address, unsigned short port) {
+	if (address->ss_family == AF_INET)
+		((struct sockaddr_in *) address)->sin_port = htons(port);
+	else
+		((struct sockaddr_in6 *) address)->sin6_port = htons(port);
+}
+
+int open_socket(int family, bool shared) {
+	// Create a non-blocking UDP socket bound to an ephemeral port: on the loopback address, or on all of them if the socket is shared (so that it receives the datagrams to every bot's address).
+
+	int handle = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if (handle < 0) {
+		perror("ERROR: Failed to create socket (try raising the limit"
+		       " on open files or using fewer bots)");
+		exit(EXIT_FAILURE);
+	}
+	if (!cpsock_set_nonblocking(handle)) {
+		perror("ERROR: Failed to set socket to non-blocking mode");
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(handle, SOL_SOCKET, SO_RCVBUF,
+	           &SOCKET_BUFFER_SIZE, sizeof(SOCKET_BUFFER_SIZE));
+	setsockopt(handle, SOL_SOCKET, SO_SNDBUF,
+	           &SOCKET_BUFFER_SIZE, sizeof(SOCKET_BUFFER_SIZE));
+
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	address.ss_family = family;
+	if (family == AF_INET) {
+		((struct sockaddr_in *) &address)->sin_addr.s_addr =
+			htonl(shared ? INADDR_ANY : INADDR_LOOPBACK);
+	} else {
+		((struct sockaddr_in6 *) &address)->sin6_addr = in6addr_loopback;
+	}
+	socklen_t address_len = (family == AF_INET)
+		? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	if (bind(handle, (const struct sockaddr *) &address, address_len) < 0) {
+		perror("ERROR: Failed to bind socket");
+		exit(EXIT_FAILURE);
+	}
+
+#if defined(PLATFORM_LINUX)
+	if (shared) {
+		int enable = 1;
+		if (setsockopt(handle, IPPROTO_IP, IP_PKTINFO,
+		               &enable, sizeof(enable)) < 0) {
+			perror("ERROR: Failed to enable IP_PKTINFO");
+			exit(EXIT_FAILURE);
+		}
+	}
+#endif
+	return handle;
+}
+
+void init_bots(void) {
+	// Open the sockets and give every bot a socket and an address.
+
+	shared_sockets = false;
+#if defined(PLATFORM_LINUX)
+	shared_sockets = server_address.ss_family == AF_INET;
+#endif
+	n_bots = options.n_bots;
+	n_sockets = shared_sockets ? options.n_sockets : n_bots;
+	if (n_sockets > n_bots)
+		n_sockets = n_bots;
+	if (shared_sockets && n_bots > 254 * 256) {
+		fprintf(stderr, "ERROR: At most %d bots are supported.\n",
+		        254 * 256);
+		exit(EXIT_FAILURE);
+	}
+
+	sockets = malloc(n_sockets * sizeof(*sockets));
+	bots = calloc(n_bots, sizeof(*bots));
+	if (sockets == NULL || bots == NULL) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	addr_map_init(&bots_by_address, rnd_next(&rnd));
+
+	for (int i_socket = 0; i_socket < n_sockets; i_socket++) {
+		sockets[i_socket] =
+			open_socket(server_address.ss_family, shared_sockets);
+	}
+	for (int i_bot = 0; i_bot < n_bots; i_bot++) {
+		Bot *bot = &bots[i_bot];
+		bot->socket = i_bot % n_sockets;
+		socklen_t address_len = sizeof(bot->local_address);
+		getsockname(sockets[bot->socket],
+		            (struct sockaddr *) &bot->local_address, &address_len);
+		if (shared_sockets) {
+			// 127.1.x.y, with y from 1 to 254.
+			uint32_t ip = (127u << 24) | (1u << 16)
+				| ((uint32_t) (i_bot / 254) << 8) | (i_bot % 254 + 1);
+			((struct sockaddr_in *) &bot->local_address)->sin_addr.s_addr =
+				htonl(ip);
+		}
+		CpsockAddressKey key =
+			cpsock_address_key((struct sockaddr *) &bot->local_address);
+		addr_map_set(&bots_by_address, &key, i_bot);
+
+		bot->state = BOT_WAITING;
+		bot->start_time = options.ramp_up * i_bot / n_bots;
+	}
+}
+
+void send_packet(Bot *bot, SPacketType type,
+                 const void *packet, size_t packet_size) {
+	// Send a packet (without its header) from the bot's address to the server.
+
+	unsigned char data[sizeof(SPacketHeader) + MAX_SENT_PACKET_SIZE];
+	s_packet_header_init(data, type);
+	memcpy(data + sizeof(SPacketHeader), packet, packet_size);
+
+	struct iovec iov;
+	iov.iov_base = data;
+	iov.iov_len = sizeof(SPacketHeader) + packet_size;
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_name = &server_address;
+	message.msg_namelen = server_address_len;
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+
+#if defined(PLATFORM_LINUX)
+	union {
+		struct cmsghdr align;
+		char buffer[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	} control;
+	if (shared_sockets) {
+		memset(&control, 0, sizeof(control));
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = IPPROTO_IP;
+		header->cmsg_type = IP_PKTINFO;
+		header->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+		struct in_pktinfo info;
+		memset(&info, 0, sizeof(info));
+		info.ipi_spec_dst =
+			((struct sockaddr_in *) &bot->local_address)->sin_addr;
+		memcpy(CMSG_DATA(header), &info, sizeof(info));
+	}
+#endif
+
+	if (sendmsg(sockets[bot->socket], &message, 0) < 0)
+		stats.n_send_errors++;
+}
+
+void send_connect(Bot *bot, double now) {
+	SConnectPacket packet;
+	packet.arena_id = options.arena_id;
+	packet.cookie = bot->cookie;
+	send_packet(bot, S_PT_CONNECT, &packet, sizeof(packet));
+	bot->connect_time = now;
+	stats.n_connects_sent++;
+}
+
+void send_input(Bot *bot, int i_bot, double now) {
+	update_input(bot, i_bot, now);
+	SPlayerInputPacket packet;
+	packet.sequence_num = ++bot->input_sequence_num;
+	packet.ack_sim_tick_sequence_num = bot->ack_sim_tick_sequence_num;
+	packet.session = bot->session;
+	packet.input = bot->input;
+	send_packet(bot, S_PT_PLAYER_INPUT, &packet, sizeof(packet));
+	stats.n_inputs_sent++;
+}
+
+void on_bot_turn(Bot *bot, int i_bot, double now) {
+	// Called at the bot's input rate: send it an input, or (re)send its connect.
+
+	switch (bot->state) {
+	case BOT_WAITING:
+		if (now < bot->start_time)
+			break;
+		bot->state = BOT_CONNECTING;
+		bot->start_time = now;
+		send_connect(bot, now);
+		break;
+	case BOT_CONNECTING:
+		if (now - bot->connect_time >= CONNECT_RETRY_INTERVAL)
+			send_connect(bot, now);
+		break;
+	case BOT_PLAYING:
+		send_input(bot, i_bot, now);
+		break;
+	}
+}
+
+
+/// Receiving.
+
+bool sim_tick_valid(unsigned char *data, size_t size) {
+	// Check that all arrays of a simulation tick are within the datagram.
+
+	if (size < SIM_TICK_PREFIX_SIZE)
+		return false;
+	SSimulationTickPacket *packet =
+		(SSimulationTickPacket *) (data + sizeof(SPacketHeader));
+	void *begin = data + SIM_TICK_PREFIX_SIZE;
+	void *end = data + size;
+	return packet->n_chunks > 0 && packet->chunk_index < packet->n_chunks
+		&& s_array_valid(&packet->players, sizeof(SPlayer), begin, end)
+		&& s_array_valid(&packet->removed_player_ids, sizeof(SPlayerId),
+		                 begin, end)
+		&& s_array_valid(&packet->explosions, sizeof(SExplosion),
+		                 begin, end)
+		&& s_array_valid(&packet->removed_explosion_ids, sizeof(SEntityId),
+		                 begin, end)
+		&& s_array_valid(&packet->projectiles, sizeof(SProjectile),
+		                 begin, end)
+		&& s_array_valid(&packet->removed_projectile_ids,
+		                 sizeof(SEntityId), begin, end);
+}
+
+void on_sim_tick(Bot *bot, unsigned char *data, size_t size, double now) {
+	if (!sim_tick_valid(data, size)) {
+		stats.n_invalid++;
+		return;
+	}
+	SSimulationTickPacket packet;
+	memcpy(&packet, data + sizeof(SPacketHeader), sizeof(packet));
+	if (packet.baseline_age != 0 && packet.sequence_num - packet.baseline_age
+	    > bot->ack_sim_tick_sequence_num)
+		stats.n_bad_baselines++;
+
+	if (bot->have_tick && packet.sequence_num < bot->tick_sequence_num) {
+		stats.n_late_chunks++;
+		return;
+	}
+	if (!bot->have_tick || packet.sequence_num > bot->tick_sequence_num) {
+		if (bot->have_tick) {
+			if (bot->n_chunks_received < bot->n_chunks)
+				stats.n_ticks_incomplete++;
+			SSequenceNum n_ticks =
+				packet.sequence_num - bot->tick_sequence_num;
+			stats.n_ticks_missed += n_ticks - 1;
+			double interval = now - bot->tick_arrival_time;
+			histogram_record(&stats.interval_us, interval * 1e6);
+			if (packet.game_settings.fps > 0) {
+				double expected = (double) n_ticks / packet.game_settings.fps;
+				histogram_record(&stats.jitter_us,
+				                 fabs(interval - expected) * 1e6);
+			}
+		}
+		bot->have_tick = true;
+		bot->tick_sequence_num = packet.sequence_num;
+		bot->n_chunks = packet.n_chunks;
+		bot->n_chunks_received = 0;
+		bot->tick_size = 0;
+		bot->tick_arrival_time = now;
+	}
+
+	bot->n_chunks_received++;
+	bot->tick_size += size;
+	if (bot->n_chunks_received == bot->n_chunks) {
+		bot->ack_sim_tick_sequence_num = packet.sequence_num;
+		stats.n_ticks_complete++;
+		histogram_record(&stats.tick_size, bot->tick_size);
+	}
+}
+
+void on_datagram(const struct sockaddr_storage *local_address,
+                 const struct sockaddr_storage *sender,
+                 unsigned char *data, size_t size, double now) {
+	stats.n_datagrams_received++;
+	stats.n_bytes_received += size;
+	histogram_record(&stats.datagram_size, size);
+
+	CpsockAddressKey sender_key =
+		cpsock_address_key((const struct sockaddr *) sender);
+	CpsockAddressKey local_key =
+		cpsock_address_key((const struct sockaddr *) local_address);
+	uint32_t i_bot;
+	if (memcmp(&sender_key, &server_key, sizeof(sender_key)) != 0
+	    || !addr_map_get(&bots_by_address, &local_key, &i_bot)) {
+		stats.n_foreign++;
+		return;
+	}
+	Bot *bot = &bots[i_bot];
+
+	if (size < sizeof(SPacketHeader)) {
+		stats.n_invalid++;
+		return;
+	}
+	SPacketHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.protocol_id != S_PROTOCOL_ID
+	    || header.protocol_version.major != S_PROTOCOL_VERSION.major) {
+		stats.n_invalid++;
+		return;
+	}
+
+	unsigned char *packet_data = data + sizeof(SPacketHeader);
+	size_t packet_size = size - sizeof(SPacketHeader);
+	switch (header.type) {
+	case S_PT_SIMULATION_TICK:
+		on_sim_tick(bot, data, size, now);
+		break;
+	case S_PT_CHALLENGE: {
+		SChallengePacket packet;
+		if (packet_size < sizeof(packet)) {
+			stats.n_invalid++;
+			break;
+		}
+		memcpy(&packet, packet_data, sizeof(packet));
+		stats.n_challenges++;
+		if (bot->state == BOT_CONNECTING) {
+			bot->cookie = packet.cookie;
+			send_connect(bot, now);
+		}
+		break;
+	}
+	case S_PT_SESSION: {
+		SSessionPacket packet;
+		if (packet_size < sizeof(packet)) {
+			stats.n_invalid++;
+			break;
+		}
+		memcpy(&packet, packet_data, sizeof(packet));
+		if (bot->state == BOT_CONNECTING) {
+			stats.n_sessions++;
+			histogram_record(&stats.connect_us,
+			                 (now - bot->start_time) * 1e6);
+			bot->session = packet.token;
+			bot->state = BOT_PLAYING;
+		}
+		break;
+	}
+	default:
+		stats.n_invalid++;
+	}
+}
+
+void receive_datagrams(int i_socket, Cptime *start_time) {
+	// Handle every datagram waiting in the socket.
+
+	static unsigned char data[MAX_RECEIVED_SIZE];
+	int handle = sockets[i_socket];
+	struct sockaddr_storage local_address;
+	socklen_t local_address_len = sizeof(local_address);
+	getsockname(handle, (struct sockaddr *) &local_address,
+	            &local_address_len);
+
+	while (true) {
+		struct sockaddr_storage sender;
+		struct iovec iov;
+		iov.iov_base = data;
+		iov.iov_len = sizeof(data);
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_name = &sender;
+		message.msg_namelen = sizeof(sender);
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+#if defined(PLATFORM_LINUX)
+		union {
+			struct cmsghdr align;
+			char buffer[CMSG_SPACE(sizeof(struct in_pktinfo))];
+		} control;
+		if (shared_sockets) {
+			message.msg_control = control.buffer;
+			message.msg_controllen = sizeof(control.buffer);
+		}
+#endif
+
+		ssize_t size = recvmsg(handle, &message, 0);
+		if (size < 0)
+			break;
+		Cptime time = cptime_time();
+
+#if defined(PLATFORM_LINUX)
+		// The bot is the datagram's destination.
+		for (struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+		     shared_sockets && header != NULL;
+		     header = CMSG_NXTHDR(&message, header)) {
+			if (header->cmsg_level == IPPROTO_IP
+			    && header->cmsg_type == IP_PKTINFO) {
+				struct in_pktinfo info;
+				memcpy(&info, CMSG_DATA(header), sizeof(info));
+				((struct sockaddr_in *) &local_address)->sin_addr =
+					info.ipi_addr;
+			}
+		}
+#endif
+		on_datagram(&local_address, &sender, data, size,
+		            cptime_elapsed(start_time, &time));
+	}
+}
+
+
+/// Report.
+
+void print_histogram(const char *name, const Histogram *histogram,
+                     double divisor, const char *unit) {
+	printf("%-24s p50 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f %s"
+	       "  (%lu samples)\n", name,
+	       histogram_percentile(histogram, 50) / divisor,
+	       histogram_percentile(histogram, 99) / divisor,
+	       histogram_percentile(histogram, 99.9) / divisor,
+	       histogram->max / divisor, unit,
+	       (unsigned long) histogram->n_values);
+}
+
+void print_progress(double now, LoadStats *previous) {
+	// Print a line about the last REPORT_INTERVAL seconds.
+
+	int n_playing = 0;
+	for (int i_bot = 0; i_bot < n_bots; i_bot++)
+		n_playing += bots[i_bot].state == BOT_PLAYING;
+	printf("[%5.1f s] %d/%d bots playing, %lu datagrams (%.0f KiB)"
+	       " received, ticks: %lu complete, %lu incomplete, %lu missed,"
+	       " %lu invalid\n",
+	       now, n_playing, n_bots,
+	       stats.n_datagrams_received - previous->n_datagrams_received,
+	       (stats.n_bytes_received - previous->n_bytes_received) / 1024.0,
+	       stats.n_ticks_complete - previous->n_ticks_complete,
+	       stats.n_ticks_incomplete - previous->n_ticks_incomplete,
+	       stats.n_ticks_missed - previous->n_ticks_missed,
+	       stats.n_invalid - previous->n_invalid);
+	fflush(stdout);
+	*previous = stats;
+}
+
+void print_report(double duration) {
+	unsigned long n_ticks = stats.n_ticks_complete + stats.n_ticks_incomplete
+		+ stats.n_ticks_missed;
+	double loss = (n_ticks == 0) ? 0
+		: 100.0 * (stats.n_ticks_incomplete + stats.n_ticks_missed) / n_ticks;
+
+	printf("\n%d bots on %d sockets (%s) for %.1f s:\n", n_bots, n_sockets,
+	       shared_sockets ? "shared with IP_PKTINFO" : "one per bot",
+	       duration);
+	printf("Sent %lu connects and %lu inputs (%lu send errors)."
+	       " Got %lu challenges and %lu sessions.\n",
+	       stats.n_connects_sent, stats.n_inputs_sent, stats.n_send_errors,
+	       stats.n_challenges, stats.n_sessions);
+	printf("Received %lu datagrams (%.1f MiB): %lu invalid, %lu not from"
+	       " the server, %lu deltas against unacknowledged baselines.\n",
+	       stats.n_datagrams_received,
+	       stats.n_bytes_received / (1024.0 * 1024.0), stats.n_invalid,
+	       stats.n_foreign, stats.n_bad_baselines);
+	printf("Ticks: %lu complete, %lu incomplete, %lu missed (lost, or"
+	       " skipped by an overloaded server), %lu late chunks."
+	       " Loss: %.2f%%.\n",
+	       stats.n_ticks_complete, stats.n_ticks_incomplete,
+	       stats.n_ticks_missed, stats.n_late_chunks, loss);
+	print_histogram("Connect time:", &stats.connect_us, 1000, "ms");
+	print_histogram("Tick inter-arrival:", &stats.interval_us, 1000, "ms");
+	print_histogram("Tick jitter:", &stats.jitter_us, 1000, "ms");
+	print_histogram("Datagram size:", &stats.datagram_size, 1, "B");
+	print_histogram("Tick size:", &stats.tick_size, 1, "B");
+}
+
+
+/// Main.
+
+int main(int argc, char **argv) {
+	if (!parse_options(argc, argv, &options)) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	cpsock_initialize();
+	rnd = rnd_state_new(time(NULL));
+
+	if (!cpsock_ip_from_string(options.server_address, &server_address)
+	    || !address_is_loopback((struct sockaddr *) &server_address)) {
+		fprintf(stderr, "ERROR: %s is not a loopback address.\n",
+		        options.server_address);
+		return EXIT_FAILURE;
+	}
+	set_port(&server_address, options.server_port);
+	server_address_len = (server_address.ss_family == AF_INET)
+		? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	server_key = cpsock_address_key((struct sockaddr *) &server_address);
+	init_bots();
+
+	struct pollfd *poll_fds = malloc(n_sockets * sizeof(*poll_fds));
+	if (poll_fds == NULL) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		return EXIT_FAILURE;
+	}
+	for (int i_socket = 0; i_socket < n_sockets; i_socket++) {
+		poll_fds[i_socket].fd = sockets[i_socket];
+		poll_fds[i_socket].events = POLLIN;
+	}
+
+	// Bots take turns in order, spread evenly over every period of the input rate.
+	Cptime start_time = cptime_time();
+	unsigned long turn_round = 0;
+	int turn_bot = 0;
+	LoadStats reported = stats;
+	double next_report_time = REPORT_INTERVAL;
+	while (true) {
+		Cptime time = cptime_time();
+		double now = cptime_elapsed(&start_time, &time);
+		if (now >= options.duration)
+			break;
+
+		double turn_time;
+		while ((turn_time = (turn_round + (double) turn_bot / n_bots)
+		                    / options.input_rate) <= now) {
+			on_bot_turn(&bots[turn_bot], turn_bot, now);
+			if (++turn_bot == n_bots) {
+				turn_bot = 0;
+				turn_round++;
+			}
+		}
+		if (now >= next_report_time) {
+			print_progress(now, &reported);
+			next_report_time += REPORT_INTERVAL;
+		}
+
+		double wait = fmin(turn_time, next_report_time) - now;
+		int n_ready = poll(poll_fds, n_sockets, (int) ceil(wait * 1000));
+		for (int i_socket = 0; n_ready > 0 && i_socket < n_sockets;
+		     i_socket++) {
+			if (poll_fds[i_socket].revents & POLLIN) {
+				receive_datagrams(i_socket, &start_time);
+				n_ready--;
+			}
+		}
+	}
+
+	print_report(options.duration);
+	for (int i_socket = 0; i_socket < n_sockets; i_socket++)
+		cpsock_close(sockets[i_socket]);
+	cpsock_shutdown();
+	return EXIT_SUCCESS;
+}
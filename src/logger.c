@@ -0,0 +1,131 @@
+#include "logger.h"
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include "cptime.h"
+#include "cpthread.h"
+#include "mpscq.h"
+
+static const double POLL_INTERVAL = 0.01; // Seconds the writer sleeps when the ring is empty.
+static const double REPORT_INTERVAL = 1; // Minimum seconds between drop reports.
+
+typedef struct LoggerEntry {
+	FILE *stream;
+	char text[LOGGER_MAX_MESSAGE_SIZE];
+} LoggerEntry;
+
+static bool within_rate_limit(Logger *logger, LoggerClass *class) {
+	// Count a message in the current second. The counts are approximate, since a message may be counted in the old second while another thread starts the new one, but they don't need a lock.
+
+	if (class->config.max_per_second == 0)
+		return true;
+
+	Cptime time = cptime_time();
+	unsigned long window = cptime_elapsed(&logger->start_time, &time);
+	unsigned long class_window = atomic_load(&class->window);
+	if (window != class_window
+	    && atomic_compare_exchange_strong(&class->window, &class_window,
+	                                      window))
+		atomic_store(&class->n_in_window, 0);
+	return atomic_fetch_add(&class->n_in_window, 1)
+		< class->config.max_per_second;
+}
+
+void logger_printf(Logger *logger, int class, FILE *stream,
+                   const char *format, ...) {
+	// Safe to call from any number of threads at once. Never blocks.
+
+	assert(class >= 0 && (size_t) class < logger->n_classes);
+	LoggerClass *logger_class = &logger->classes[class];
+	if (!within_rate_limit(logger, logger_class)) {
+		atomic_fetch_add(&logger_class->n_rate_limited, 1);
+		return;
+	}
+
+	LoggerEntry entry;
+	entry.stream = stream;
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(entry.text, sizeof(entry.text), format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if ((size_t) length >= sizeof(entry.text))
+		entry.text[sizeof(entry.text) - 2] = '\n';
+
+	if (!mpsc_queue_push(&logger->entries, &entry))
+		atomic_fetch_add(&logger_class->n_overflowed, 1);
+}
+
+static void report_drops(Logger *logger, unsigned long *n_reported) {
+	// Write how many messages of each class were dropped since the last report. n_reported: 2 counts per class, the rate-limited and overflowed totals reported so far.
+
+	for (size_t i_class = 0; i_class < logger->n_classes; i_class++) {
+		LoggerClass *class = &logger->classes[i_class];
+		unsigned long n_rate_limited = atomic_load(&class->n_rate_limited);
+		unsigned long n_overflowed = atomic_load(&class->n_overflowed);
+		unsigned long *reported = &n_reported[2 * i_class];
+		if (n_rate_limited == reported[0] && n_overflowed == reported[1])
+			continue;
+		fprintf(stderr, "WARNING: Dropped %lu log messages (%s): %lu over"
+		        " the rate limit, %lu with the log full.\n",
+		        (n_rate_limited - reported[0]) + (n_overflowed - reported[1]),
+		        class->config.name, n_rate_limited - reported[0],
+		        n_overflowed - reported[1]);
+		reported[0] = n_rate_limited;
+		reported[1] = n_overflowed;
+	}
+	fflush(stderr);
+}
+
+static void writer_thread(void *arg) {
+	// Poll the ring rather than have loggers wake us up, so that logging never touches a lock.
+
+	Logger *logger = arg;
+	unsigned long *n_reported = calloc(2 * logger->n_classes,
+	                                   sizeof(unsigned long));
+	Cptime last_report_time = cptime_time();
+	while (true) {
+		LoggerEntry entry;
+		bool wrote = false;
+		while (mpsc_queue_pop(&logger->entries, &entry)) {
+			fputs(entry.text, entry.stream);
+			wrote = true;
+		}
+		if (wrote) {
+			fflush(stdout);
+			fflush(stderr);
+		}
+
+		Cptime time = cptime_time();
+		if (cptime_elapsed(&last_report_time, &time) >= REPORT_INTERVAL) {
+			report_drops(logger, n_reported);
+			last_report_time = time;
+		}
+		cptime_sleep(POLL_INTERVAL);
+	}
+}
+
+bool logger_init(Logger *logger, size_t capacity,
+                 const LoggerClassConfig *classes, size_t n_classes) {
+	// Start the writer thread. Return value: false if it couldn't be started.
+
+	mpsc_queue_init(&logger->entries, sizeof(LoggerEntry), capacity);
+	logger->start_time = cptime_time();
+	logger->n_classes = n_classes;
+	logger->classes = malloc(n_classes * sizeof(LoggerClass));
+	for (size_t i_class = 0; i_class < n_classes; i_class++) {
+		LoggerClass *class = &logger->classes[i_class];
+		class->config = classes[i_class];
+		atomic_init(&class->window, 0);
+		atomic_init(&class->n_in_window, 0);
+		atomic_init(&class->n_rate_limited, 0);
+		atomic_init(&class->n_overflowed, 0);
+	}
+	return cpthread_create(&logger->writer, writer_thread, logger);
+}
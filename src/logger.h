@@ -0,0 +1,44 @@
+// Logging from threads that mustn't block: messages are formatted by the caller, queued in a lock-free ring and written out by a background thread, so a slow or blocked stdout only costs dropped messages.
+// Every message belongs to a class with its own rate limit. Messages over the limit, or that don't fit in the ring, are dropped and counted, and the writer thread reports how many were lost (at most once a second).
+
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include "cptime.h"
+#include "cpthread.h"
+#include "mpscq.h"
+
+enum { LOGGER_MAX_MESSAGE_SIZE = 256 }; // Including the null terminator. Longer messages are truncated.
+
+typedef struct LoggerClassConfig {
+	const char *name; // For the drop reports.
+	unsigned long max_per_second; // 0 for no limit.
+} LoggerClassConfig;
+
+typedef struct LoggerClass {
+	LoggerClassConfig config;
+	atomic_ulong window; // Second (since the logger started) that n_in_window counts.
+	atomic_ulong n_in_window;
+	atomic_ulong n_rate_limited; // Dropped over the rate limit (since the logger started).
+	atomic_ulong n_overflowed; // Dropped because the ring was full.
+} LoggerClass;
+
+typedef struct Logger {
+	MpscQueue entries;
+	Cptime start_time;
+	size_t n_classes;
+	LoggerClass *classes;
+	Cpthread writer;
+} Logger;
+
+bool logger_init(Logger *logger, size_t capacity,
+                 const LoggerClassConfig *classes, size_t n_classes);
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 4, 5)))
+#endif
+void logger_printf(Logger *logger, int class, FILE *stream,
+                   const char *format, ...);
@@ -6,57 +6,147 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
-#include <math.h>
 #include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
+#include "addrmap.h"
 #include "cpsock.h"
 #include "cptime.h"
+#include "cpthread.h"
+#include "evloop.h"
 #include "serialization.h"
+#include "siphash.h"
+#include "slotmap.h"
+#include "snapshot.h"
+#include "histogram.h"
+#include "interest.h"
+#include "mpscq.h"
+#include "kinematics.h"
+#include "logger.h"
+#include "ring.h"
 #include "vector.h"
-#include "color.h"
-#include "vec2f.h"
+#include "workpool.h"
+#include "world.h"
 
-typedef SVectorInt VectorInt;
 typedef SPlayerId PlayerId;
 typedef SPlayerInput PlayerInput;
 typedef SSequenceNum SequenceNum;
 
-typedef struct Player {
-	SPlayerId id;
+// Player input or connect decoded by a receiver thread.
+typedef struct QueuedInput {
+	struct sockaddr_storage address;
+	SPacketType type; // S_PT_PLAYER_INPUT, or S_PT_CONNECT for a connect with a valid cookie (packet is unused then).
+	SPlayerInputPacket packet;
+} QueuedInput;
+
+enum { INPUT_PACKET_SIZE = sizeof(SPacketHeader) + sizeof(SPlayerInputPacket) };
+enum { MAX_RECEIVED_SIZE = sizeof(SPacketHeader) + sizeof(SStatsQueryPacket) }; // The biggest packet that clients send (queries are padded, see SStatsQueryPacket). Bigger datagrams are truncated.
+
+// Received input datagram that hasn't been parsed yet.
+typedef struct InboxEntry {
 	struct sockaddr_storage address;
+	SequenceNum sequence_num;
+	unsigned char data[INPUT_PACKET_SIZE];
+} InboxEntry;
 
-	PlayerInput input;
+// Challenge or session packet to be sent to a client (see serialization.h).
+typedef struct HandshakeReply {
+	struct sockaddr_storage address;
+	size_t size;
+	unsigned char data[sizeof(SPacketHeader) + sizeof(SSessionPacket)];
+} HandshakeReply;
+
+// The newest input datagram from each address (and session token), collected until they're queued for their arenas (see inbox_add).
+typedef struct InputInbox {
+	AddrMap indices; // Index in entries of the first datagram from each address.
+	Vector entries; // Of InboxEntry.
+	Vector challenges; // Of HandshakeReply, sent after every batch of received datagrams.
+} InputInbox;
+
+// Statistics query from an allowed address (see STATS_QUERY_ADDRESSES), waiting for the main thread to answer it.
+typedef struct StatsQuery {
+	struct sockaddr_storage address;
+	uint32_t query_id;
+} StatsQuery;
+
+// A simulation tick packet encoded against a particular baseline (see send_sim_tick_packets).
+typedef struct EncodedPacket {
+	SSequenceNum sequence_num; // Of the snapshot, 0 if none.
+	Vector data; // Chunks, back to back.
+	Vector chunk_ends; // Of size_t (see snapshot_encode).
+} EncodedPacket;
+
+// What the network threads need to know about a player to send it a snapshot, captured together with the snapshot (so they never look at live players).
+typedef struct Recipient {
+	struct sockaddr_storage address;
+	SPlayerId id;
+	SlotHandle interest;
 	SequenceNum input_sequence_num;
-	Cptime last_input_time;
-
-	bool alive;
-	int ticks_until_respawn;
-
-	Vec2f position;
-	float heading;
-	Vec2f velocity;
-	int last_shot_tick;
-
-	int score;
-	Color color;
-} Player;
-
-typedef struct Projectile {
-	Vec2f position;
-	float heading;
-	Vec2f velocity;
-	SPlayerId shooter_id;
-	int creation_tick;
-} Projectile;
-
-typedef struct Explosion {
-	Vec2f position;
-	int creation_tick;
-} Explosion;
-
-#if !defined(M_PI)
-#define M_PI 3.14159265358979323846264338327
-#endif
+	SequenceNum ack_sim_tick_sequence_num;
+} Recipient;
+
+// Parts of the work on ticks that are timed (see profile).
+enum Phase {
+	// On the main thread.
+	PHASE_RECEIVE, // Reading datagrams between ticks.
+	PHASE_QUEUE_INPUTS,
+	PHASE_WAIT_FOR_SENDS, // Of the previous tick, before capturing.
+	PHASE_TICK, // Everything from simulating to starting the sends.
+	// For each arena, on the thread that runs it.
+	PHASE_APPLY_INPUTS,
+	PHASE_CLEAN_UP,
+	PHASE_SIMULATION,
+	PHASE_CAPTURE,
+	PHASE_SEND,
+	N_PHASES
+};
+
+_Static_assert((int) N_PHASES <= (int) S_STATS_MAX_PHASES,
+               "Stats queries aren't padded enough for every phase.");
+
+// Stats queries smaller than this are ignored (see SStatsQueryPacket).
+enum { STATS_REPLY_SIZE = sizeof(SPacketHeader) + sizeof(SStatsReplyPacket)
+                          + N_PHASES * sizeof(SPhaseStats) };
+
+const char *const PHASE_NAMES[N_PHASES] = {
+	"receive", "queue inputs", "wait for sends", "tick",
+	"apply inputs", "clean up", "simulation", "capture", "send",
+};
+
+// Messages logged while the server runs (see logger.h), each class with its own rate limit.
+enum LogClass {
+	LOG_BAD_PACKETS, // Malformed, from another version or for a nonexistent arena.
+	LOG_CONNECTIONS, // Players connecting and disconnecting.
+	LOG_STATS, // Periodic statistics.
+	N_LOG_CLASSES
+};
+
+// Everything that belongs to one match. Arenas don't share any state, so they can be ticked in parallel (but each one by only one thread at a time).
+typedef struct Arena {
+	int index; // In arenas. Clients join an arena by sending its index as arena_id.
+
+	World world;
+
+	AddrMap player_addresses; // Values are handles of players.
+	MpscQueue inputs; // Of QueuedInput, applied at the start of each tick.
+	Vector new_sessions; // Of HandshakeReply, for clients that connected since the last capture.
+
+	SnapshotHistory snapshot_history;
+	int capture_tick; // Of the newest snapshot in the history.
+	Vector recipients; // Of Recipient, captured with the newest snapshot.
+	Vector sessions; // Of HandshakeReply, sent along with the newest snapshot.
+	EncodedPacket encoded[SNAPSHOT_HISTORY_LEN + 1]; // One for each baseline in the history (at the same index) and a full snapshot (at the end).
+
+	// Area-of-interest culling (if INTEREST_RADIUS > 0).
+	SlotMap interests; // Of InterestHistory, one for each player. Only added and removed in capture_snapshot, while the network threads are idle.
+	Vector removed_interests; // Of SlotHandle, of players that left since the last capture.
+	InterestIndex interest_index; // Of the newest snapshot, built by the network threads.
+
+	CpsockStats net_stats; // Added to the global net_stats after every tick.
+	int64_t phase_times[N_PHASES]; // Nanoseconds, of the arena's phases (-1 if they haven't run), recorded in the global profile after every tick.
+} Arena;
 
 #if defined(PLATFORM_WINDOWS) // Problems with binding an IPv6 socket.
 const bool USE_IPV6 = false;
@@ -64,534 +154,1296 @@ const bool USE_IPV6 = false;
 const bool USE_IPV6 = true;
 #endif
 const unsigned short LISTEN_PORT = 6642;
+const bool USE_BATCHED_IO = true; // recvmmsg/sendmmsg (where supported).
+const size_t MAX_DATAGRAM_SIZE = 1200; // Bytes of UDP payload. Bigger snapshots are split into chunks, so that they don't get fragmented (1200 leaves room for IPv6 and UDP headers within the 1280-byte minimum MTU).
+const int N_ARENAS = 1; // Independent matches hosted by this process.
+const int N_WORKER_THREADS = 0; // Threads that tick arenas in addition to the main one.
+const int N_NETWORK_THREADS = 1; // Threads that encode and send snapshots while the next tick is simulated (0 to do it on the main thread).
+const int N_RECEIVER_THREADS = 0; // Threads reading inputs from their own SO_REUSEPORT sockets (Linux only, 0 to read them on the main thread).
+const size_t INPUT_QUEUE_CAPACITY = 4096; // Per arena, inputs waiting to be applied.
+const bool USE_EPOLL = true; // Wake up on incoming packets and timerfd ticks (where supported).
 const float PLAYER_TIMEOUT = 30; // Seconds.
+const float COOKIE_LIFETIME = 10; // Seconds that a handshake cookie is accepted for (at least, and at most twice as long).
+const float STATS_INTERVAL = 60; // Seconds between printouts of statistics (0 to only print them on SIGUSR1).
+const char *const STATS_QUERY_ADDRESSES[] = {"127.0.0.1", "::1"}; // IPs (with any port) that may query statistics with S_PT_STATS_QUERY packets.
+const size_t N_STATS_QUERY_ADDRESSES =
+	sizeof(STATS_QUERY_ADDRESSES) / sizeof(STATS_QUERY_ADDRESSES[0]);
+const LoggerClassConfig LOG_CLASSES[N_LOG_CLASSES] = { // Names and messages per second allowed (0 for no limit).
+	{"bad packets", 10},
+	{"connections", 200},
+	{"stats", 0},
+};
+const size_t LOG_CAPACITY = 1024; // Messages waiting for the writer thread (more are dropped).
+const size_t STATS_QUERY_QUEUE_CAPACITY = 16; // Queries waiting to be answered (after the next tick).
+const float INTEREST_RADIUS = 0; // Pixels around its player within which a client is sent entities (0 to send the whole level, which clients that show all of it need).
+const float INTEREST_HYSTERESIS = 100; // Extra pixels before an entity that a client already has is culled.
+
+// Overload handling (see update_overload).
+const unsigned long MAX_CATCH_UP_TICKS = 3; // Ticks run back to back after falling behind, once snapshots are already sent as rarely as they can be. Any more are dropped.
+const unsigned long MAX_STALL_CATCH_UP_TICKS = FPS; // Ticks run back to back before that, so that only a long stall drops ticks.
+const int MAX_SNAPSHOT_INTERVAL = 4; // In ticks.
+const int OVERLOAD_RECOVERY_TICKS = 2 * FPS; // Ticks on schedule before snapshots are sent more often again.
+const float MAX_SEND_WAIT = 0.5 / FPS; // Seconds the network threads may wait for a full send buffer to drain before dropping the rest of a tick's snapshots.
+const unsigned long MAX_RECEIVED_PER_TICK = 4096; // Datagrams the simulation thread reads between ticks. The rest wait in the socket's buffer (or get dropped by the kernel).
+const float MAX_RECEIVE_TIME = 0.2 / FPS; // Seconds the simulation thread spends reading datagrams between ticks.
+
+Arena *arenas; // N_ARENAS of them.
+Logger logger; // Everything printed after startup goes through it, so that a blocked stdout can't stall ticks.
+WorkPool arena_workers;
+WorkPool network_workers;
+
+// Inputs are read on the main thread or on receiver threads, and queued for their arenas.
+int n_receiver_threads = 0;
+atomic_ulong n_queued_inputs; // Since the last stats printout.
+atomic_ulong n_dropped_inputs; // Because the queue was full.
+atomic_ulong n_superseded_inputs; // By newer ones from the same address.
+InputInbox main_inbox; // Inputs read on the main thread, queued at the start of each tick.
+
+// Handshake (see serialization.h). Cookies and session tokens are keyed hashes, so that they can't be forged without the key.
+SipHashKey handshake_key; // Random, set at startup.
+Cptime start_time; // Cookies are made for windows of COOKIE_LIFETIME since then.
+atomic_ulong n_challenges; // Sent since the last stats printout.
+atomic_ulong n_bad_cookies; // Forged or expired.
+atomic_ulong n_bad_sessions; // Inputs with an invalid token or from a wrong address.
+
+// Received datagrams that were dropped, by reason (since startup).
+struct {
+	atomic_ulong bad_protocol_id;
+	atomic_ulong bad_version;
+	atomic_ulong bad_type;
+	atomic_ulong bad_size;
+} n_bad_packets;
+
+// Traffic on the receiver threads' sockets (since startup), added up after every burst of datagrams.
+struct {
+	atomic_ulong n_datagrams_received;
+	atomic_ullong n_bytes_received;
+	atomic_ulong n_datagrams_sent;
+	atomic_ullong n_bytes_sent;
+} receiver_traffic;
+
+// Statistics queries (see StatsQuery).
+MpscQueue stats_queries; // Of StatsQuery.
+CpsockAddressKey *stats_query_keys; // Of STATS_QUERY_ADDRESSES.
+
+// Datagrams read on the main thread since the last tick (see receive_packets).
+struct {
+	unsigned long n_datagrams;
+	double time; // Seconds.
+} receive_budget;
+
+// When we can't keep up, snapshots are sent only every snapshot_interval ticks.
+struct {
+	int snapshot_interval;
+	int n_ticks_until_snapshot;
+	int n_ticks_on_schedule; // Since the last overrun.
+} overload = {1, 0, 0};
+
+// Statistics since the last printout.
+CpsockStats net_stats;
+struct {
+	unsigned long n_ticks;
+	unsigned long n_overruns; // Wakeups that found more than one tick due.
+	unsigned long n_dropped_ticks; // Beyond the catch-up limit (see update_overload).
+	unsigned long n_skipped_snapshots;
+	double max_tick_time; // Seconds.
+	unsigned long max_receive_syscalls; // Per tick.
+	unsigned long max_send_syscalls; // Per tick.
+	unsigned long n_receive_budget_exhausted; // Ticks.
+} tick_stats;
+
+// Durations of phases in nanoseconds (see enum Phase), and numbers of entities in arenas after every tick, since the last stats printout.
+struct {
+	Histogram phases[N_PHASES];
+	Histogram n_players;
+	Histogram n_projectiles;
+	Histogram n_explosions;
+} profile;
+volatile sig_atomic_t stats_requested = 0; // By SIGUSR1.
+
+// Totals since startup of the statistics that every printout resets (for stats queries).
+struct {
+	CpsockStats net_stats;
+	unsigned long n_dropped_inputs;
+	unsigned long n_ticks;
+	unsigned long n_overruns;
+	unsigned long n_dropped_ticks;
+	unsigned long n_skipped_snapshots;
+} lifetime_stats;
 
-enum { FPS = 30 };
 
-// Sizes (in pixels).
-const VectorInt LEVEL_SIZE = {800, 600};
-const float PLAYER_RADIUS = 30;
+/// Network.
 
-// Speeds and accelerations (in pixels / tick and pixels / tick^2).
-const float PLAYER_ACCELERATION = 150.0 / (FPS * FPS);
-const float PLAYER_BRAKING = -75.0 / (FPS * FPS);
-const float PLAYER_TURN_RATE = M_PI / FPS;
-const float SPEED_LIMIT = 500.0 / FPS;
-const float PROJECTILE_SPEED = 500.0 / FPS;
+void random_bytes(void *buffer, size_t size) {
+	// Fill buffer with bytes that can't be guessed, from the OS if possible (rand is seeded with the time, so it's only a fallback).
+	FILE *file = fopen("/dev/urandom", "rb");
+	bool success = file != NULL && fread(buffer, 1, size, file) == size;
+	if (file != NULL)
+		fclose(file);
+	if (success)
+		return;
+
+	fprintf(stderr, "WARNING: /dev/urandom isn't available, handshake"
+	        " cookies and hash seeds may be predictable.\n");
+	for (size_t i_byte = 0; i_byte < size; i_byte++)
+		((unsigned char *) buffer)[i_byte] = rand();
+}
 
-// Delays (in ticks).
-const int SHOT_COOLDOWN = 0.5 * FPS;
-const int PROJECTILE_LIFETIME = 1.5 * FPS;
-const int EXPLOSION_LIFETIME = 5 * FPS;
-const int PLAYER_RESPAWN_DELAY = 1 * FPS;
+uint64_t session_secret(Arena *arena, Player *player) {
+	// The secret of a player's session token. It depends on the player's ID (which is never reused) so that tokens of players who left don't work for new ones in the same slot.
+	unsigned char message[sizeof(SArenaId) + sizeof(SlotHandle)
+	                      + sizeof(SPlayerId)];
+	SArenaId arena_id = arena->index;
+	memcpy(message, &arena_id, sizeof(arena_id));
+	memcpy(message + sizeof(arena_id), &player->handle, sizeof(player->handle));
+	memcpy(message + sizeof(arena_id) + sizeof(player->handle), &player->id,
+	       sizeof(player->id));
+	return siphash(&handshake_key, message, sizeof(message));
+}
 
-Vector players;
-Vector projectiles;
-Vector explosions;
+Player *add_player(Arena *arena, struct sockaddr_storage address) {
+	// Add a player that has completed the handshake.
 
-int curr_tick = 0;
-SPlayerId next_player_id = 0;
+	// Log connection event.
+	char addr_str[CPSOCK_IP_TO_STRING_LEN];
+	cpsock_ip_to_string((struct sockaddr *) &address,
+	                    addr_str, sizeof(addr_str));
+	logger_printf(&logger, LOG_CONNECTIONS, stdout,
+	              "Player connected to arena %d: %s, port %d.\n",
+	              arena->index, addr_str,
+	              cpsock_ip_port((struct sockaddr *) &address));
+
+	Player *player = world_add_player(&arena->world);
+	player->interest = SLOT_HANDLE_NONE;
+	player->address = address;
+	player->session_secret = session_secret(arena, player);
+	player->input_sequence_num = 0;
+	player->ack_sim_tick_sequence_num = 0;
+	player->last_input_time = cptime_time();
 
+	CpsockAddressKey key = cpsock_address_key((struct sockaddr *) &address);
+	addr_map_set(&arena->player_addresses, &key, player->handle);
+	return player;
+}
 
-/// Math utilities.
+void clean_up_disconnected_players(Arena *arena) {
+	Cptime time = cptime_time();
 
-float normalize_angle(float angle) {
-	// Normalize an angle in radians to [0, 2 * M_PI).
-	float result = fmod(angle, 2 * M_PI);
-	if (result < 0)
-		result += 2 * M_PI;
-	return result;
+	SlotMap *players = &arena->world.players;
+	for (size_t i_player = 0; i_player < slot_map_size(players);) {
+		Player *player = slot_map_at(players, i_player);
+		if (cptime_elapsed(&player->last_input_time, &time) > PLAYER_TIMEOUT) {
+			// Log disconnection event.
+			char addr_str[CPSOCK_IP_TO_STRING_LEN];
+			cpsock_ip_to_string((struct sockaddr *) &player->address,
+			                    addr_str, sizeof(addr_str));
+			logger_printf(&logger, LOG_CONNECTIONS, stdout,
+			              "Player disconnected from arena %d: %s, port %d.\n",
+			              arena->index, addr_str,
+			              cpsock_ip_port((struct sockaddr *) &player->address));
+
+			CpsockAddressKey key =
+				cpsock_address_key((struct sockaddr *) &player->address);
+			addr_map_delete(&arena->player_addresses, &key);
+			if (player->interest != SLOT_HANDLE_NONE) {
+				vector_push(&arena->removed_interests,
+				            &player->interest);
+			}
+			slot_map_remove(players, player->handle); // The last player takes its place.
+		} else {
+			i_player++;
+		}
+	}
 }
 
+bool same_address(const struct sockaddr_storage *a,
+                  const struct sockaddr_storage *b) {
+	CpsockAddressKey key_a = cpsock_address_key((const struct sockaddr *) a);
+	CpsockAddressKey key_b = cpsock_address_key((const struct sockaddr *) b);
+	return memcmp(&key_a, &key_b, sizeof(key_a)) == 0;
+}
 
-/// Physics and other game logic.
+void on_connect(Arena *arena, struct sockaddr_storage address) {
+	// Add the player of a client that has completed the handshake (unless it's already in the arena), and send it its session along with the next snapshot.
 
-Player *player_by_id(SPlayerId id) {
-	for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-		Player *player = vector_get(&players, i_player);
-		if (player->id == id)
-			return player;
+	Player *player = NULL;
+	CpsockAddressKey key = cpsock_address_key((struct sockaddr *) &address);
+	uint32_t handle;
+	if (addr_map_get(&arena->player_addresses, &key, &handle))
+		player = slot_map_get(&arena->world.players, handle);
+	if (player == NULL)
+		player = add_player(arena, address);
+
+	SSessionPacket packet;
+	packet.token.arena_id = arena->index;
+	packet.token.player_handle = player->handle;
+	packet.token.secret = player->session_secret;
+
+	HandshakeReply reply;
+	reply.address = address;
+	reply.size = sizeof(SPacketHeader) + sizeof(packet);
+	s_packet_header_init(reply.data, S_PT_SESSION);
+	memcpy(reply.data + sizeof(SPacketHeader), &packet, sizeof(packet));
+	vector_push(&arena->new_sessions, &reply);
+}
+
+void on_player_input_packet(Arena *arena, struct sockaddr_storage address,
+                            SPlayerInputPacket *packet) {
+	// The session token leads straight to the player's slot. Tokens that the player wasn't given, or that come from another address than the player's, are ignored.
+	SSessionToken session = packet->session;
+	Player *player =
+		slot_map_get(&arena->world.players, session.player_handle);
+	if (player == NULL || session.secret != player->session_secret
+	    || !same_address(&address, &player->address)) {
+		atomic_fetch_add(&n_bad_sessions, 1);
+		return;
 	}
 
-	return NULL;
+	// Ignore stale input.
+	if (packet->sequence_num < player->input_sequence_num)
+		return;
+
+	player->input = packet->input;
+	player->input_sequence_num = packet->sequence_num;
+	if (packet->ack_sim_tick_sequence_num
+	    <= (SequenceNum) arena->world.curr_tick)
+		player->ack_sim_tick_sequence_num = packet->ack_sim_tick_sequence_num;
+	else // Ticks from the future aren't valid baselines.
+		player->ack_sim_tick_sequence_num = 0;
+	player->last_input_time = cptime_time();
 }
 
-Vec2f find_spacious_position() {
-	// Return a position that is approximately the farthest away from screen edges and collidable objects.
+bool parse_packet(const CpsockDatagram *datagram, SPacketType type,
+                  void *packet, size_t packet_size) {
+	// Validate a received datagram and decode the packet of the given type in it (without its header). Safe to call from receiver threads. Return value: false if the datagram should be ignored.
 
-	static const float STEP_SIZE = 20;
-	Vec2f curr_position = { STEP_SIZE, STEP_SIZE };
+	const unsigned char *packet_data = datagram->data;
 
-	Vec2f best_position;
-	float best_distance = 0;
+	// Ignore packets with bad size, protocol, version or type.
+	if (datagram->size < sizeof(SPacketHeader)) {
+		atomic_fetch_add(&n_bad_packets.bad_size, 1);
+		return false;
+	}
+	const SPacketHeader *header = (const SPacketHeader *) packet_data;
+	if (header->protocol_id != S_PROTOCOL_ID) {
+		atomic_fetch_add(&n_bad_packets.bad_protocol_id, 1);
+		return false;
+	}
+	SVersion version = header->protocol_version;
+	if (version.major != S_PROTOCOL_VERSION.major) {
+		atomic_fetch_add(&n_bad_packets.bad_version, 1);
+		logger_printf(&logger, LOG_BAD_PACKETS, stderr,
+		              "WARNING: received a packet with incompatible version"
+		              " %d.%d (mine is %d.%d).\n",
+		              version.major, version.minor,
+		              S_PROTOCOL_VERSION.major, S_PROTOCOL_VERSION.minor);
+		return false;
+	}
+	if (header->type != type) {
+		atomic_fetch_add(&n_bad_packets.bad_type, 1);
+		logger_printf(&logger, LOG_BAD_PACKETS, stdout,
+		              "WARNING: Ignoring a packet of unexpected type.\n");
+		return false;
+	}
+	if (datagram->size < sizeof(SPacketHeader) + packet_size) {
+		atomic_fetch_add(&n_bad_packets.bad_size, 1);
+		logger_printf(&logger, LOG_BAD_PACKETS, stderr,
+		              "WARNING: received a too small packet.\n");
+		return false;
+	}
 
-	do {
-		float curr_distance = INFINITY;
-
-		curr_distance = fmin(curr_distance, curr_position.x);
-		curr_distance = fmin(curr_distance, LEVEL_SIZE.x - curr_position.x);
-		curr_distance = fmin(curr_distance, curr_position.y);
-		curr_distance = fmin(curr_distance, LEVEL_SIZE.y - curr_position.y);
-
-		for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-			Player *player = vector_get(&players, i_player);
-			if (player->alive) {
-				curr_distance = fmin(
-					curr_distance,
-					vec2f_distance(curr_position, player->position));
-			}
-		}
+	memcpy(packet, packet_data + sizeof(SPacketHeader), packet_size);
+	return true;
+}
 
-		for (size_t i_projectile = 0; i_projectile < projectiles.n_elems;
-		     i_projectile++) {
-			Projectile *projectile = vector_get(&projectiles, i_projectile);
-			curr_distance = fmin(
-				curr_distance,
-				vec2f_distance(curr_position, projectile->position));
-		}
+void queue_input(SArenaId arena_id, QueuedInput *input) {
+	// Queue a received input or connect for its arena. Safe to call from receiver threads.
 
-		if (curr_distance > best_distance) {
-			best_position = curr_position;
-			best_distance = curr_distance;
-		}
+	if (arena_id >= N_ARENAS) {
+		logger_printf(&logger, LOG_BAD_PACKETS, stderr,
+		              "WARNING: received a packet for nonexistent arena"
+		              " %d.\n", arena_id);
+		return;
+	}
 
-		curr_position.x += STEP_SIZE;
-		if (LEVEL_SIZE.x - curr_position.x <= STEP_SIZE) {
-			curr_position.x = STEP_SIZE;
-			curr_position.y += STEP_SIZE;
-		}
-	} while (LEVEL_SIZE.y - curr_position.y > STEP_SIZE);
+	if (mpsc_queue_push(&arenas[arena_id].inputs, input))
+		atomic_fetch_add(&n_queued_inputs, 1);
+	else
+		atomic_fetch_add(&n_dropped_inputs, 1);
+}
 
-	return best_position;
+void queue_player_input(CpsockDatagram *datagram) {
+	QueuedInput input;
+	if (!parse_packet(datagram, S_PT_PLAYER_INPUT,
+	                  &input.packet, sizeof(input.packet)))
+		return;
+	input.address = datagram->address;
+	input.type = S_PT_PLAYER_INPUT;
+	queue_input(input.packet.session.arena_id, &input);
 }
 
-void player_spawn(Player *player) {
-	player->alive = true;
+uint64_t cookie_window(void) {
+	// Cookies are made for windows of COOKIE_LIFETIME seconds.
+	Cptime time = cptime_time();
+	return cptime_elapsed(&start_time, &time) / COOKIE_LIFETIME;
+}
 
-	player->heading = M_PI / 2;
-	player->velocity.x = 0;
-	player->velocity.y = 0;
-	player->position = find_spacious_position();
+SCookie connect_cookie(const struct sockaddr_storage *address,
+                       SArenaId arena_id, uint64_t window) {
+	// The cookie for a client at address to join an arena, in the given window. Never 0.
+	CpsockAddressKey key =
+		cpsock_address_key((const struct sockaddr *) address);
+	unsigned char message[sizeof(key) + sizeof(arena_id) + sizeof(window)];
+	memcpy(message, &key, sizeof(key));
+	memcpy(message + sizeof(key), &arena_id, sizeof(arena_id));
+	memcpy(message + sizeof(key) + sizeof(arena_id), &window, sizeof(window));
+	return siphash(&handshake_key, message, sizeof(message)) | 1;
+}
 
-	player->last_shot_tick = curr_tick;
+void on_connect_packet(InputInbox *inbox, const CpsockDatagram *datagram) {
+	// Queue a connect with a valid cookie for its arena, and answer any other one with a challenge. Neither keeps any state, so a flood of connects (from spoofed addresses or not) only costs a couple of hashes per packet. Safe to call from receiver threads.
+
+	SConnectPacket packet;
+	if (!parse_packet(datagram, S_PT_CONNECT, &packet, sizeof(packet)))
+		return;
+	if (packet.arena_id >= N_ARENAS)
+		return;
+
+	// A cookie from the previous window is accepted too, so that one made just before the window ends doesn't expire right away.
+	uint64_t window = cookie_window();
+	SCookie cookie = connect_cookie(&datagram->address, packet.arena_id, window);
+	if (packet.cookie != 0) {
+		if (packet.cookie == cookie || (window > 0 && packet.cookie
+		    == connect_cookie(&datagram->address, packet.arena_id,
+		                      window - 1))) {
+			QueuedInput input;
+			memset(&input, 0, sizeof(input));
+			input.address = datagram->address;
+			input.type = S_PT_CONNECT;
+			queue_input(packet.arena_id, &input);
+			return;
+		}
+		atomic_fetch_add(&n_bad_cookies, 1);
+	}
+
+	SChallengePacket challenge;
+	challenge.arena_id = packet.arena_id;
+	challenge.cookie = cookie;
+	HandshakeReply reply;
+	reply.address = datagram->address;
+	reply.size = sizeof(SPacketHeader) + sizeof(challenge);
+	s_packet_header_init(reply.data, S_PT_CHALLENGE);
+	memcpy(reply.data + sizeof(SPacketHeader), &challenge, sizeof(challenge));
+	vector_push(&inbox->challenges, &reply);
+	atomic_fetch_add(&n_challenges, 1);
 }
 
-Color next_player_color(void) {
-	for (int i_color = 0;; i_color++) {
-		Color color = color_distinct(i_color);
+void send_handshake_replies(int handle, Vector *replies, double max_wait,
+                            CpsockStats *stats) {
+	// Send a Vector of HandshakeReply and empty it.
+
+	CpsockDatagram datagrams[CPSOCK_MAX_BATCH];
+	for (size_t i_first = 0; i_first < replies->n_elems;
+	     i_first += CPSOCK_MAX_BATCH) {
+		int n_batch = 0;
+		for (size_t i_reply = i_first; i_reply < replies->n_elems
+		     && n_batch < CPSOCK_MAX_BATCH; i_reply++) {
+			HandshakeReply *reply = vector_get(replies, i_reply);
+			CpsockDatagram *datagram = &datagrams[n_batch++];
+			datagram->address = reply->address;
+			datagram->prefix = NULL;
+			datagram->prefix_size = 0;
+			datagram->data = reply->data;
+			datagram->size = reply->size;
+		}
+		cpsock_send_all(handle, datagrams, n_batch, max_wait, stats);
+	}
+	vector_resize(replies, 0);
+}
 
-		bool color_used = false;
-		for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-			Player *player = vector_get(&players, i_player);
-			if (color_equal(player->color, color)) {
-				color_used = true;
-				break;
+void inbox_init(InputInbox *inbox) {
+	uint64_t seed; // So that clients can't pick addresses that collide.
+	random_bytes(&seed, sizeof(seed));
+	addr_map_init(&inbox->indices, seed);
+	vector_init(&inbox->entries, sizeof(InboxEntry));
+	vector_init(&inbox->challenges, sizeof(HandshakeReply));
+}
+
+void inbox_add(InputInbox *inbox, const CpsockDatagram *datagram) {
+	// Keep an input datagram if it's the newest one from its address with its session token. This only looks at the sequence number and token, so that floods are dropped cheaply. Everything else is checked when the inbox is flushed.
+	// Sequence numbers aren't authenticated, so a datagram only supersedes one with the same token: otherwise, one spoofed datagram per tick with a huge sequence number would replace the player's real input (and then fail the session check). Datagrams with another token than the first one from their address are all kept, and sorted out by on_player_input_packet.
+
+	if (datagram->size < INPUT_PACKET_SIZE) {
+		atomic_fetch_add(&n_bad_packets.bad_size, 1);
+		return;
+	}
+	const char *packet_data = (char *) datagram->data + sizeof(SPacketHeader);
+	SequenceNum sequence_num;
+	memcpy(&sequence_num,
+	       packet_data + offsetof(SPlayerInputPacket, sequence_num),
+	       sizeof(sequence_num));
+	const char *session =
+		packet_data + offsetof(SPlayerInputPacket, session);
+
+	CpsockAddressKey key =
+		cpsock_address_key((struct sockaddr *) &datagram->address);
+	uint32_t i_entry;
+	if (addr_map_get(&inbox->indices, &key, &i_entry)) {
+		InboxEntry *entry = vector_get(&inbox->entries, i_entry);
+		if (memcmp(entry->data + sizeof(SPacketHeader)
+		           + offsetof(SPlayerInputPacket, session),
+		           session, sizeof(SSessionToken)) == 0) {
+			atomic_fetch_add(&n_superseded_inputs, 1);
+			if (sequence_num > entry->sequence_num) {
+				entry->sequence_num = sequence_num;
+				memcpy(entry->data, datagram->data, INPUT_PACKET_SIZE);
 			}
+			return;
 		}
+	} else {
+		addr_map_set(&inbox->indices, &key, inbox->entries.n_elems);
+	}
+
+	vector_resize(&inbox->entries, inbox->entries.n_elems + 1);
+	InboxEntry *entry =
+		vector_get(&inbox->entries, inbox->entries.n_elems - 1);
+	entry->address = datagram->address;
+	entry->sequence_num = sequence_num;
+	memcpy(entry->data, datagram->data, INPUT_PACKET_SIZE);
+}
 
-		if (!color_used)
-			return color;
+void inbox_flush(InputInbox *inbox) {
+	// Parse the collected inputs, queue them for their arenas and empty the inbox.
+	for (size_t i_entry = 0; i_entry < inbox->entries.n_elems; i_entry++) {
+		InboxEntry *entry = vector_get(&inbox->entries, i_entry);
+		CpsockDatagram datagram;
+		datagram.address = entry->address;
+		datagram.data = entry->data;
+		datagram.size = INPUT_PACKET_SIZE;
+		queue_player_input(&datagram);
+	}
+	if (inbox->entries.n_elems > 0) {
+		addr_map_clear(&inbox->indices);
+		vector_resize(&inbox->entries, 0);
 	}
 }
 
-void add_player(struct sockaddr_storage address) {
-	// Add a player. (Doesn't initialize input or input_sequence_num.)
+bool stats_query_allowed(const struct sockaddr_storage *address) {
+	// Only the IP matters, not the port.
+	CpsockAddressKey key =
+		cpsock_address_key((const struct sockaddr *) address);
+	for (size_t i_key = 0; i_key < N_STATS_QUERY_ADDRESSES; i_key++) {
+		if (key.family == stats_query_keys[i_key].family
+		    && memcmp(key.address, stats_query_keys[i_key].address,
+		              sizeof(key.address)) == 0)
+			return true;
+	}
+	return false;
+}
 
-	// Log connection event.
-	char addr_str[CPSOCK_IP_TO_STRING_LEN];
-	cpsock_ip_to_string((struct sockaddr *) &address,
-	                    addr_str, sizeof(addr_str));
-	printf("Player connected: %s, port %d.\n", addr_str,
-		   cpsock_ip_port((struct sockaddr *) &address));
-
-	Player new_player;
-	new_player.id = next_player_id++;
-	new_player.address = address;
-	new_player.score = 0;
-	new_player.color = next_player_color();
-	player_spawn(&new_player);
-	vector_push(&players, &new_player);
-}
-
-void player_shoot(Player *player) {
-	player->last_shot_tick = curr_tick;
-
-	Projectile projectile;
-	projectile.shooter_id = player->id;
-	projectile.creation_tick = curr_tick;
-	projectile.position = vec2f_wrap_position(
-		vec2f_add(player->position,
-		          vec2f_from_polar(player->heading, PLAYER_RADIUS)),
-		LEVEL_SIZE);
-	projectile.heading = player->heading;
-	projectile.velocity = vec2f_from_polar(
-		projectile.heading, PROJECTILE_SPEED);
-	vector_push(&projectiles, &projectile);
-}
-
-void player_die(Player *player) {
-	player->alive = false;
-	player->ticks_until_respawn = PLAYER_RESPAWN_DELAY;
-
-	Explosion new_explosion;
-	new_explosion.position = player->position;
-	new_explosion.creation_tick = curr_tick;
-	vector_push(&explosions, &new_explosion);
-}
-
-void tick_simulation(void) {
-	curr_tick++;
-
-	// Tick explosions (i.e. delete the ones whose lifetime has elapsed).
-	for (size_t i_explosion = 0; i_explosion < explosions.n_elems;) {
-		Explosion *explosion = vector_get(&explosions, i_explosion);
-		if (curr_tick - explosion->creation_tick > EXPLOSION_LIFETIME)
-			vector_delete(&explosions, i_explosion);
-		else
-			i_explosion++;
+void on_stats_query_packet(const CpsockDatagram *datagram) {
+	// Queue a stats query for the main thread (which has the statistics), if it comes from an allowed address. Safe to call from receiver threads.
+
+	if (!stats_query_allowed(&datagram->address))
+		return;
+	// The source address may be spoofed, so never reply with more than was received.
+	if (datagram->size < STATS_REPLY_SIZE) {
+		atomic_fetch_add(&n_bad_packets.bad_size, 1);
+		return;
 	}
+	SStatsQueryPacket packet;
+	if (!parse_packet(datagram, S_PT_STATS_QUERY, &packet, sizeof(packet)))
+		return;
+
+	StatsQuery query;
+	query.address = datagram->address;
+	query.query_id = packet.query_id;
+	mpsc_queue_push(&stats_queries, &query); // Dropped if there are too many.
+}
 
-	// Tick players.
-	for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-		Player *player = vector_get(&players, i_player);
+void receive_datagram(InputInbox *inbox, const CpsockDatagram *datagram) {
+	// Sort a received datagram by its type. Only the protocol ID is checked here, the rest when the packet is parsed.
+	SPacketHeader header;
+	if (datagram->size < sizeof(header)) {
+		atomic_fetch_add(&n_bad_packets.bad_size, 1);
+		return;
+	}
+	memcpy(&header, datagram->data, sizeof(header));
+	if (header.protocol_id != S_PROTOCOL_ID) {
+		atomic_fetch_add(&n_bad_packets.bad_protocol_id, 1);
+		return;
+	}
+	if (header.type == S_PT_PLAYER_INPUT)
+		inbox_add(inbox, datagram);
+	else if (header.type == S_PT_CONNECT)
+		on_connect_packet(inbox, datagram);
+	else if (header.type == S_PT_STATS_QUERY)
+		on_stats_query_packet(datagram);
+	else
+		atomic_fetch_add(&n_bad_packets.bad_type, 1);
+}
 
-		if (!player->alive) {
-			player->ticks_until_respawn--;
-			if (player->ticks_until_respawn <= 0)
-				player_spawn(player);
-			continue;
-		}
+bool receive_packets(int handle) {
+	// Read datagrams into main_inbox (and answer connects), until the socket is drained or the receive budget runs out (so that a flood can't delay the tick). Return value: false if the budget ran out.
 
-		// Rotation.
-		switch (player->input.rotate) {
-		case S_PR_LEFT:
-			player->heading += PLAYER_TURN_RATE;
-			break;
-		case S_PR_RIGHT:
-			player->heading -= PLAYER_TURN_RATE;
-			break;
-		default:
-			break;
-		}
-		player->heading = normalize_angle(player->heading);
-
-		// Acceleration.
-		float acceleration;
-		switch (player->input.accelerate) {
-		case S_PA_FORWARD:
-			acceleration = PLAYER_ACCELERATION;
-			break;
-		case S_PA_REVERSE:
-			acceleration = PLAYER_BRAKING;
-			break;
-		default:
-			acceleration = 0;
-			break;
-		}
-		player->velocity = vec2f_velocity_add(
-			player->velocity,
-			vec2f_from_polar(player->heading, acceleration),
-			SPEED_LIMIT);
-
-		// Position.
-		player->position = vec2f_wrap_position(
-			vec2f_add(player->position, player->velocity), LEVEL_SIZE);
-
-		// Shooting.
-		if (player->input.shoot
-		    && curr_tick >= player->last_shot_tick + SHOT_COOLDOWN) {
-			player_shoot(player);
+	// We only accept small packets, so anything past this size is truncated.
+	static unsigned char buffers[CPSOCK_MAX_BATCH][MAX_RECEIVED_SIZE];
+	CpsockDatagram datagrams[CPSOCK_MAX_BATCH];
+
+	Cptime receive_start_time = cptime_time();
+	double start_budget_time = receive_budget.time;
+	while (true) {
+		if (receive_budget.n_datagrams >= MAX_RECEIVED_PER_TICK
+		    || receive_budget.time >= MAX_RECEIVE_TIME)
+			return false;
+
+		for (int i_datagram = 0; i_datagram < CPSOCK_MAX_BATCH; i_datagram++) {
+			datagrams[i_datagram].data = buffers[i_datagram];
+			datagrams[i_datagram].size = MAX_RECEIVED_SIZE;
 		}
-	}
 
-	// Tick projectiles.
-	for (size_t i_projectile = 0; i_projectile < projectiles.n_elems;) {
-		Projectile *projectile = vector_get(&projectiles, i_projectile);
+		int n_datagrams = cpsock_receive_batch(
+			handle, datagrams, CPSOCK_MAX_BATCH, &net_stats);
+		if (n_datagrams <= 0) // No more packets to process.
+			return true;
 
-		// Position.
-		projectile->position = vec2f_wrap_position(
-			vec2f_add(projectile->position, projectile->velocity), LEVEL_SIZE);
+		for (int i_datagram = 0; i_datagram < n_datagrams; i_datagram++)
+			receive_datagram(&main_inbox, &datagrams[i_datagram]);
+		send_handshake_replies(handle, &main_inbox.challenges, 0, &net_stats);
 
-		// Delete the projectile if its lifetime has elapsed.
-		if (curr_tick - projectile->creation_tick > PROJECTILE_LIFETIME)
-			vector_delete(&projectiles, i_projectile);
-		else
-			i_projectile++;
+		receive_budget.n_datagrams += n_datagrams;
+		Cptime time = cptime_time();
+		receive_budget.time =
+			start_budget_time + cptime_elapsed(&receive_start_time, &time);
+
+		if (n_datagrams < CPSOCK_MAX_BATCH) // The socket has been drained.
+			return true;
 	}
+}
 
-	// Collision detection.
-	for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-		Player *player = vector_get(&players, i_player);
-		if (!player->alive)
-			continue;
 
-		bool player_dies = false;
+/// Receiver threads.
 
-		// Collisions with other players.
-		for (size_t i_other = i_player + 1; i_other < players.n_elems; i_other++) {
-			Player *other = vector_get(&players, i_other);
-			if (!other->alive)
-				continue;
+void receiver_thread(void *arg) {
+	// Read and validate inputs and connects from one socket, and queue them for their arenas.
 
-			float distance = vec2f_distance(player->position, other->position);
-			if (distance < PLAYER_RADIUS * 2) {
-				player_dies = true;
-				player_die(other);
-			}
-		}
+	int handle = (int) (intptr_t) arg;
+	unsigned char buffers[CPSOCK_MAX_BATCH][MAX_RECEIVED_SIZE];
+	CpsockDatagram datagrams[CPSOCK_MAX_BATCH];
+	CpsockStats stats; // Added to receiver_traffic after every burst (net_stats belongs to the main thread).
+	memset(&stats, 0, sizeof(stats));
+	InputInbox inbox;
+	inbox_init(&inbox);
 
-		// Collisions with projectiles.
-		for (size_t i_projectile = 0; i_projectile < projectiles.n_elems;) {
-			Projectile *projectile = vector_get(&projectiles, i_projectile);
-
-			float distance = vec2f_distance(
-				player->position, projectile->position);
-			if (distance < PLAYER_RADIUS) {
-				Player *shooter = player_by_id(projectile->shooter_id);
-				if (shooter == player)
-					shooter->score--;
-				else if (shooter != NULL)
-					shooter->score++;
-
-				player_dies = true;
-				vector_delete(&projectiles, i_projectile);
-			} else {
-				i_projectile++;
+	while (cpsock_wait_readable(handle)) {
+		while (true) {
+			for (int i_datagram = 0; i_datagram < CPSOCK_MAX_BATCH;
+			     i_datagram++) {
+				datagrams[i_datagram].data = buffers[i_datagram];
+				datagrams[i_datagram].size = MAX_RECEIVED_SIZE;
 			}
+
+			int n_datagrams = cpsock_receive_batch(
+				handle, datagrams, CPSOCK_MAX_BATCH, &stats);
+			if (n_datagrams <= 0)
+				break;
+
+			for (int i_datagram = 0; i_datagram < n_datagrams; i_datagram++)
+				receive_datagram(&inbox, &datagrams[i_datagram]);
+			send_handshake_replies(handle, &inbox.challenges, 0, &stats);
+
+			if (n_datagrams < CPSOCK_MAX_BATCH)
+				break;
 		}
 
-		if (player_dies)
-			player_die(player);
+		// Receiver threads don't know when ticks start, so they only keep the newest input from each address within every burst.
+		inbox_flush(&inbox);
+
+		atomic_fetch_add(&receiver_traffic.n_datagrams_received,
+		                 stats.n_datagrams_received);
+		atomic_fetch_add(&receiver_traffic.n_bytes_received,
+		                 stats.n_bytes_received);
+		atomic_fetch_add(&receiver_traffic.n_datagrams_sent,
+		                 stats.n_datagrams_sent);
+		atomic_fetch_add(&receiver_traffic.n_bytes_sent, stats.n_bytes_sent);
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	perror("ERROR: Receiver thread failed to wait for packets");
+	exit(EXIT_FAILURE);
+}
+
+void apply_queued_inputs(Arena *arena) {
+	QueuedInput input;
+	while (mpsc_queue_pop(&arena->inputs, &input)) {
+		if (input.type == S_PT_CONNECT)
+			on_connect(arena, input.address);
+		else
+			on_player_input_packet(arena, input.address, &input.packet);
 	}
 }
 
+SGameSettings game_settings(void) {
+	SGameSettings settings;
+	settings.player_timeout = PLAYER_TIMEOUT;
+	settings.level_size = LEVEL_SIZE;
+	settings.fps = FPS;
+	settings.projectile_lifetime = PROJECTILE_LIFETIME;
+	return settings;
+}
 
-/// Network.
+void update_interest_histories(Arena *arena) {
+	// Free the interest histories of players that left and create them for ones that joined. Only called while the network threads are idle.
 
-void clean_up_disconnected_players(void) {
-	Cptime time = cptime_time();
+	for (size_t i_handle = 0; i_handle < arena->removed_interests.n_elems;
+	     i_handle++) {
+		SlotHandle handle =
+			*(SlotHandle *) vector_get(&arena->removed_interests, i_handle);
+		interest_history_free(slot_map_get(&arena->interests, handle));
+		slot_map_remove(&arena->interests, handle);
+	}
+	vector_resize(&arena->removed_interests, 0);
+
+	SlotMap *players = &arena->world.players;
+	for (size_t i_player = 0; i_player < slot_map_size(players); i_player++) {
+		Player *player = slot_map_at(players, i_player);
+		if (player->interest == SLOT_HANDLE_NONE) {
+			InterestHistory history;
+			interest_history_init(&history);
+			player->interest = slot_map_insert(&arena->interests, &history);
+		}
+	}
+}
 
-	for (size_t i_player = 0; i_player < players.n_elems;) {
-		Player *player = vector_get(&players, i_player);
-		if (cptime_elapsed(&player->last_input_time, &time) > PLAYER_TIMEOUT) {
-			// Log disconnection event.
-			char addr_str[CPSOCK_IP_TO_STRING_LEN];
-			cpsock_ip_to_string((struct sockaddr *) &player->address,
-			                    addr_str, sizeof(addr_str));
-			printf("Player disconnected: %s, port %d.\n", addr_str,
-			       cpsock_ip_port((struct sockaddr *) &player->address));
+void capture_snapshot(Arena *arena) {
+	// Record the world state of the current tick in the snapshot history, along with its recipients and the sessions of clients that have connected since the last capture.
+
+	Snapshot *snapshot = snapshot_history_add(&arena->snapshot_history,
+	                                          arena->world.curr_tick);
+	world_capture(&arena->world, snapshot);
+
+	if (INTEREST_RADIUS > 0)
+		update_interest_histories(arena);
+
+	arena->capture_tick = arena->world.curr_tick;
+	Vector sent_sessions = arena->sessions;
+	arena->sessions = arena->new_sessions;
+	arena->new_sessions = sent_sessions;
+	vector_resize(&arena->new_sessions, 0);
+	vector_resize(&arena->recipients, 0);
+	SlotMap *players = &arena->world.players;
+	for (size_t i_player = 0; i_player < slot_map_size(players); i_player++) {
+		Player *player = slot_map_at(players, i_player);
+		Recipient recipient;
+		recipient.address = player->address;
+		recipient.id = player->id;
+		recipient.interest = player->interest;
+		recipient.input_sequence_num = player->input_sequence_num;
+		recipient.ack_sim_tick_sequence_num =
+			player->ack_sim_tick_sequence_num;
+		vector_push(&arena->recipients, &recipient);
+	}
+}
+
+void encode_culled_packet(Arena *arena, Snapshot *snapshot,
+                          Recipient *recipient,
+                          const SGameSettings *settings,
+                          EncodedPacket *packet) {
+	// Encode the part of snapshot near the recipient's player, delta-compressed against the part of its baseline that it was sent.
+
+	static _Thread_local bool scratch_initialized = false;
+	static _Thread_local Snapshot view, baseline_view;
+	if (!scratch_initialized) {
+		snapshot_init(&view);
+		snapshot_init(&baseline_view);
+		scratch_initialized = true;
+	}
+
+	InterestHistory *history =
+		slot_map_get(&arena->interests, recipient->interest);
+	interest_cull(&arena->interest_index, snapshot, history, recipient->id,
+	              &view);
+
+	Snapshot *baseline = snapshot_history_baseline(
+		&arena->snapshot_history, snapshot,
+		recipient->ack_sim_tick_sequence_num);
+	bool has_baseline = baseline != NULL
+		&& interest_baseline(history, baseline, &baseline_view);
+	snapshot_encode(&view, has_baseline ? &baseline_view : NULL, settings,
+	                MAX_DATAGRAM_SIZE, &packet->data, &packet->chunk_ends);
+	packet->sequence_num = snapshot->sequence_num;
+}
+
+void send_sim_tick_packets(Arena *arena, int handle, double max_wait) {
+	// Send the newest captured snapshot to its recipients, delta-compressed against the last one each of them acknowledged. Recipients with the same baseline share the encoded packet, and only get their own copy of the (small) prefix of each chunk with the per-recipient fields patched in. With area-of-interest culling, each recipient gets its own packet instead (see encode_culled_packet).
+	// Runs on the network threads while the arena simulates the next tick, so it must only use the snapshot history, recipients, sessions, encoded packets and interest histories.
+	// If the socket's send buffer fills up, waits up to max_wait seconds for it to drain, and drops whatever is left after that: the recipients will get a newer snapshot soon anyway.
+
+	Snapshot *snapshot =
+		snapshot_history_get(&arena->snapshot_history, arena->capture_tick);
+	assert(snapshot != NULL);
+	SGameSettings settings = game_settings();
+
+	typedef struct Prefix {
+		unsigned char data[SNAPSHOT_PACKET_PREFIX_SIZE];
+	} Prefix;
+
+	// Buffers, extended if necessary.
+	static _Thread_local EncodedPacket **recipient_packets = NULL;
+	static _Thread_local EncodedPacket *culled_packets = NULL;
+	static _Thread_local size_t n_recipients_allocated = 0;
+	static _Thread_local Prefix *prefixes = NULL;
+	static _Thread_local CpsockDatagram *datagrams = NULL;
+	static _Thread_local size_t n_datagrams_allocated = 0;
+	size_t n_recipients = arena->recipients.n_elems;
+	if (n_recipients > n_recipients_allocated) {
+		free(recipient_packets);
+		recipient_packets = malloc(n_recipients * sizeof(*recipient_packets));
+		culled_packets = realloc(culled_packets,
+		                         n_recipients * sizeof(*culled_packets));
+		for (size_t i_packet = n_recipients_allocated;
+		     i_packet < n_recipients; i_packet++) {
+			culled_packets[i_packet].sequence_num = 0;
+			vector_init(&culled_packets[i_packet].data, 1);
+			vector_init(&culled_packets[i_packet].chunk_ends, sizeof(size_t));
+		}
+		n_recipients_allocated = n_recipients;
+	}
 
-			vector_delete(&players, i_player);
+	// With culling, every recipient gets a different packet, so nothing is shared.
+	if (INTEREST_RADIUS > 0 && n_recipients > 0)
+		interest_index_build(&arena->interest_index, snapshot);
+
+	// Sessions go first, since they're small and clients can't send inputs without them.
+	size_t n_sessions = arena->sessions.n_elems;
+	size_t n_datagrams = n_sessions;
+	for (size_t i_recipient = 0; i_recipient < n_recipients; i_recipient++) {
+		Recipient *recipient = vector_get(&arena->recipients, i_recipient);
+		EncodedPacket *packet;
+
+		if (INTEREST_RADIUS > 0) {
+			packet = &culled_packets[i_recipient];
+			encode_culled_packet(arena, snapshot, recipient, &settings,
+			                     packet);
 		} else {
-			i_player++;
+			// Fall back to a full snapshot if the baseline is too old.
+			Snapshot *baseline = snapshot_history_baseline(
+				&arena->snapshot_history, snapshot,
+				recipient->ack_sim_tick_sequence_num);
+			packet = &arena->encoded[SNAPSHOT_HISTORY_LEN];
+			if (baseline != NULL) {
+				packet = &arena->encoded[
+					baseline->sequence_num % SNAPSHOT_HISTORY_LEN];
+			}
+			if (packet->sequence_num != snapshot->sequence_num) {
+				snapshot_encode(snapshot, baseline, &settings,
+				                MAX_DATAGRAM_SIZE, &packet->data,
+				                &packet->chunk_ends);
+				packet->sequence_num = snapshot->sequence_num;
+			}
 		}
+
+		recipient_packets[i_recipient] = packet;
+		n_datagrams += packet->chunk_ends.n_elems;
 	}
-}
 
-void on_player_input_packet(struct sockaddr_storage address,
-                            SPlayerInputPacket *packet) {
-	Player *player = NULL;
-	for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-		Player *this_player = vector_get(&players, i_player);
-		if (cpsock_ip_equal((struct sockaddr *) &this_player->address,
-		                    (struct sockaddr *) &address)) {
-			player = this_player;
-			break;
+	if (n_datagrams > n_datagrams_allocated) {
+		n_datagrams_allocated = n_datagrams;
+		free(prefixes);
+		free(datagrams);
+		prefixes = malloc(n_datagrams_allocated * sizeof(*prefixes));
+		datagrams = malloc(n_datagrams_allocated * sizeof(*datagrams));
+	}
+
+	for (size_t i_session = 0; i_session < n_sessions; i_session++) {
+		HandshakeReply *reply = vector_get(&arena->sessions, i_session);
+		CpsockDatagram *datagram = &datagrams[i_session];
+		datagram->address = reply->address;
+		datagram->prefix = NULL;
+		datagram->prefix_size = 0;
+		datagram->data = reply->data;
+		datagram->size = reply->size;
+	}
+
+	// One datagram for each chunk. Start from a different recipient every tick, so that when datagrams are dropped at the end, it's not always the same ones.
+	size_t i_datagram = n_sessions;
+	for (size_t i = 0; i < n_recipients; i++) {
+		size_t i_recipient = (arena->capture_tick + i) % n_recipients;
+		Recipient *recipient = vector_get(&arena->recipients, i_recipient);
+		EncodedPacket *packet = recipient_packets[i_recipient];
+		size_t chunk_begin = 0;
+		for (size_t i_chunk = 0; i_chunk < packet->chunk_ends.n_elems;
+		     i_chunk++) {
+			size_t chunk_end =
+				*(size_t *) vector_get(&packet->chunk_ends, i_chunk);
+			char *chunk = (char *) packet->data.array + chunk_begin;
+
+			Prefix *prefix = &prefixes[i_datagram];
+			memcpy(prefix->data, chunk, sizeof(prefix->data));
+			snapshot_patch_recipient(prefix->data, recipient->id,
+			                         recipient->input_sequence_num);
+
+			CpsockDatagram *datagram = &datagrams[i_datagram];
+			datagram->address = recipient->address;
+			datagram->prefix = prefix->data;
+			datagram->prefix_size = sizeof(prefix->data);
+			datagram->data = chunk + sizeof(prefix->data);
+			datagram->size = chunk_end - chunk_begin - sizeof(prefix->data);
+
+			chunk_begin = chunk_end;
+			i_datagram++;
 		}
 	}
 
-	if (player == NULL) {
-		add_player(address);
-		player = vector_get(&players, players.n_elems - 1);
+	// Datagrams that can't be sent are dropped, as if they got lost on the way (and counted in the stats).
+	cpsock_send_all(handle, datagrams, n_datagrams, max_wait,
+	                &arena->net_stats);
+}
+
+
+/// Overload handling.
+
+unsigned long update_overload(unsigned long n_ticks_due) {
+	// Called on every wakeup with the number of tick deadlines that have passed. Return value: how many ticks to run.
+	// If we fall behind, first send snapshots less often (they're the most expensive part of a tick), and only if that's not enough, drop ticks, so that a stall never results in an unbounded burst of ticks.
+
+	// Dropping ticks is the last resort: until the snapshot interval is at its maximum, fall behind a lot more before any are dropped.
+	unsigned long max_ticks =
+		(overload.snapshot_interval >= MAX_SNAPSHOT_INTERVAL)
+		? MAX_CATCH_UP_TICKS : MAX_STALL_CATCH_UP_TICKS;
+
+	if (n_ticks_due > 1) {
+		tick_stats.n_overruns++;
+		overload.n_ticks_on_schedule = 0;
+		overload.snapshot_interval *= 2;
+		if (overload.snapshot_interval > MAX_SNAPSHOT_INTERVAL)
+			overload.snapshot_interval = MAX_SNAPSHOT_INTERVAL;
 	} else {
-		// Ignore stale input.
-		if (packet->sequence_num < player->input_sequence_num)
-			return;
+		overload.n_ticks_on_schedule += n_ticks_due;
+		if (overload.n_ticks_on_schedule >= OVERLOAD_RECOVERY_TICKS
+		    && overload.snapshot_interval > 1) {
+			overload.snapshot_interval /= 2;
+			overload.n_ticks_on_schedule = 0;
+		}
 	}
 
-	player->input = packet->input;
-	player->input_sequence_num = packet->sequence_num;
-	player->last_input_time = cptime_time();
+	if (n_ticks_due > max_ticks) {
+		tick_stats.n_dropped_ticks += n_ticks_due - max_ticks;
+		return max_ticks;
+	}
+	return n_ticks_due;
 }
 
-void receive_packets(int handle) {
-	while (true) {
-		enum { MAX_PACKET_SIZE = 65515 }; // Max UDP packet size (RFC 768).
-		unsigned char packet_data[MAX_PACKET_SIZE];
+bool should_send_snapshot(bool catching_up) {
+	// Ticks that will immediately be followed by another one don't get a snapshot, since it would be out of date before it arrived.
 
-		struct sockaddr_storage from;
-		socklen_t from_size = sizeof(from);
-		ssize_t packet_size =
-			recvfrom(handle, (char *) packet_data, MAX_PACKET_SIZE,
-					 0, (struct sockaddr *) &from, &from_size);
+	if (overload.n_ticks_until_snapshot > 0)
+		overload.n_ticks_until_snapshot--;
+	if (catching_up || overload.n_ticks_until_snapshot > 0) {
+		tick_stats.n_skipped_snapshots++;
+		return false;
+	}
+	overload.n_ticks_until_snapshot = overload.snapshot_interval;
+	return true;
+}
 
-		if (packet_size < 0) // No more packets to process.
-			break;
 
-		// Ignore packets with bad size, protocol, version or type.
-		if ((unsigned) packet_size < sizeof(SPacketHeader))
-			continue;
-		SPacketHeader *header = (SPacketHeader *) packet_data;
-		if (header->protocol_id != S_PROTOCOL_ID)
-			continue;
-		SVersion version = header->protocol_version;
-		if (version.major != S_PROTOCOL_VERSION.major) {
-			fprintf(stderr,
-			        "WARNING: received a packet with incompatible version"
-			        " %d.%d (mine is %d.%d).\n",
-			        version.major, version.minor,
-			        S_PROTOCOL_VERSION.major, S_PROTOCOL_VERSION.minor);
-			continue;
-		}
-		if (header->type != S_PT_PLAYER_INPUT) {
-			printf("WARNING: Ignoring a packet of unexpected type.\n");
-			continue;
+/// Statistics.
+
+uint64_t elapsed_ns(Cptime *start, Cptime *end) {
+	double elapsed = cptime_elapsed(start, end);
+	return (elapsed > 0) ? (uint64_t) (elapsed * 1e9) : 0;
+}
+
+void arena_time_phase(Arena *arena, enum Phase phase,
+                      Cptime *start, Cptime *end) {
+	arena->phase_times[phase] = elapsed_ns(start, end);
+}
+
+void collect_arena_profiles(void) {
+	// Record the phase times and entity counts of arenas in the global profile. Only called while no arena work is running (network workers included).
+	for (int i_arena = 0; i_arena < N_ARENAS; i_arena++) {
+		Arena *arena = &arenas[i_arena];
+		for (int phase = 0; phase < N_PHASES; phase++) {
+			if (arena->phase_times[phase] >= 0) {
+				histogram_record(&profile.phases[phase],
+				                 arena->phase_times[phase]);
+				arena->phase_times[phase] = -1;
+			}
 		}
-		if ((unsigned) packet_size
-		    < sizeof(SPacketHeader) + sizeof(SPlayerInputPacket)) {
-			fprintf(stderr,
-			        "WARNING: received a too small player input packet.\n");
+		histogram_record(&profile.n_players,
+		                 slot_map_size(&arena->world.players));
+		histogram_record(&profile.n_projectiles,
+		                 slot_map_size(&arena->world.projectiles));
+		histogram_record(&profile.n_explosions,
+		                 ring_size(&arena->world.explosions));
+	}
+}
+
+void update_tick_stats(CpsockStats *tick_start_net_stats, double tick_time) {
+	tick_stats.n_ticks++;
+	if (tick_time > tick_stats.max_tick_time)
+		tick_stats.max_tick_time = tick_time;
+
+	unsigned long n_receive_syscalls = net_stats.n_receive_syscalls
+		- tick_start_net_stats->n_receive_syscalls;
+	if (n_receive_syscalls > tick_stats.max_receive_syscalls)
+		tick_stats.max_receive_syscalls = n_receive_syscalls;
+
+	unsigned long n_send_syscalls = net_stats.n_send_syscalls
+		- tick_start_net_stats->n_send_syscalls;
+	if (n_send_syscalls > tick_stats.max_send_syscalls)
+		tick_stats.max_send_syscalls = n_send_syscalls;
+}
+
+void print_stats(void) {
+	if (tick_stats.n_ticks == 0)
+		return;
+
+	double n_ticks = tick_stats.n_ticks;
+	logger_printf(&logger, LOG_STATS, stdout,
+	              "Stats: %lu ticks; per tick: %.1f receive syscalls (max %lu),"
+	              " %.1f send syscalls (max %lu), %.1f datagrams in,"
+	              " %.1f datagrams out, %.0f bytes out.\n",
+	              tick_stats.n_ticks,
+	              net_stats.n_receive_syscalls / n_ticks,
+	              tick_stats.max_receive_syscalls,
+	              net_stats.n_send_syscalls / n_ticks,
+	              tick_stats.max_send_syscalls,
+	              net_stats.n_datagrams_received / n_ticks,
+	              net_stats.n_datagrams_sent / n_ticks,
+	              net_stats.n_bytes_sent / n_ticks);
+	logger_printf(&logger, LOG_STATS, stdout,
+	              "Stats: %lu send buffer waits, %lu datagrams dropped because"
+	              " the buffer stayed full, %lu send errors.\n",
+	              net_stats.n_send_retries, net_stats.n_send_timeouts,
+	              net_stats.n_send_errors);
+	logger_printf(&logger, LOG_STATS, stdout,
+	              "Stats: %lu overruns, %lu dropped ticks, %lu skipped"
+	              " snapshots, snapshot interval %d, max tick time %.1f ms.\n",
+	              tick_stats.n_overruns, tick_stats.n_dropped_ticks,
+	              tick_stats.n_skipped_snapshots, overload.snapshot_interval,
+	              tick_stats.max_tick_time * 1000);
+	unsigned long n_dropped = atomic_exchange(&n_dropped_inputs, 0);
+	logger_printf(&logger, LOG_STATS, stdout,
+	              "Stats: %lu inputs queued, %lu dropped (queue full), %lu"
+	              " superseded by newer ones from the same address; receive"
+	              " budget exhausted in %lu ticks.\n",
+	              atomic_exchange(&n_queued_inputs, 0), n_dropped,
+	              atomic_exchange(&n_superseded_inputs, 0),
+	              tick_stats.n_receive_budget_exhausted);
+	logger_printf(&logger, LOG_STATS, stdout,
+	              "Stats: %lu handshake challenges sent, %lu connects with"
+	              " a bad or expired cookie, %lu inputs with a bad session.\n",
+	              atomic_exchange(&n_challenges, 0),
+	              atomic_exchange(&n_bad_cookies, 0),
+	              atomic_exchange(&n_bad_sessions, 0));
+
+	for (int phase = 0; phase < N_PHASES; phase++) {
+		Histogram *histogram = &profile.phases[phase];
+		if (histogram->n_values == 0)
 			continue;
-		}
+		logger_printf(&logger, LOG_STATS, stdout,
+		              "Profile: %-14s p50 %7.3f, p99 %7.3f, p99.9 %7.3f,"
+		              " max %7.3f ms (%lu samples).\n", PHASE_NAMES[phase],
+		              histogram_percentile(histogram, 50) / 1e6,
+		              histogram_percentile(histogram, 99) / 1e6,
+		              histogram_percentile(histogram, 99.9) / 1e6,
+		              histogram->max / 1e6,
+		              (unsigned long) histogram->n_values);
+	}
+	logger_printf(&logger, LOG_STATS, stdout,
+	              "Profile: entities per arena and tick: players p50 %lu,"
+	              " max %lu; projectiles p50 %lu, max %lu; explosions p50 %lu,"
+	              " max %lu.\n",
+	              (unsigned long) histogram_percentile(&profile.n_players, 50),
+	              (unsigned long) profile.n_players.max,
+	              (unsigned long)
+	                  histogram_percentile(&profile.n_projectiles, 50),
+	              (unsigned long) profile.n_projectiles.max,
+	              (unsigned long)
+	                  histogram_percentile(&profile.n_explosions, 50),
+	              (unsigned long) profile.n_explosions.max);
+
+	cpsock_stats_add(&lifetime_stats.net_stats, &net_stats);
+	lifetime_stats.n_dropped_inputs += n_dropped;
+	lifetime_stats.n_ticks += tick_stats.n_ticks;
+	lifetime_stats.n_overruns += tick_stats.n_overruns;
+	lifetime_stats.n_dropped_ticks += tick_stats.n_dropped_ticks;
+	lifetime_stats.n_skipped_snapshots += tick_stats.n_skipped_snapshots;
+	memset(&net_stats, 0, sizeof(net_stats));
+	memset(&tick_stats, 0, sizeof(tick_stats));
+	memset(&profile, 0, sizeof(profile));
+}
 
-		// Process player input packet.
-		SPlayerInputPacket *packet = (SPlayerInputPacket *)
-			(packet_data + sizeof(SPacketHeader));
-		on_player_input_packet(from, packet);
-	}
-}
-
-void send_sim_tick_packet(int handle, int i_dest_player) {
-	Player *dest_player = vector_get(&players, i_dest_player);
-
-	size_t packet_size =
-		sizeof(SPacketHeader) +
-		sizeof(SSimulationTickPacket) +
-		players.n_elems * sizeof(SPlayer) +
-		explosions.n_elems * sizeof(SExplosion) +
-		projectiles.n_elems * sizeof(SProjectile);
-
-	// Buffer for packets, extended if necessary.
-	static void *packet_buffer = NULL;
-	static size_t packet_buffer_size = 0;
-	if (packet_size > packet_buffer_size) {
-		packet_buffer_size = packet_size;
-		free(packet_buffer);
-		packet_buffer = malloc(packet_buffer_size);
-	}
-
-	void *packet_begin = packet_buffer;
-	char *packet_end = packet_begin; // char* instead of void* to simplify pointer arithmetic.
-
-	// Header.
-	SPacketHeader *header = (SPacketHeader *) packet_end;
-	packet_end += sizeof(*header);
-	s_packet_header_init(header, S_PT_SIMULATION_TICK);
-
-	// Game settings and other non-array data.
-	SSimulationTickPacket *tick_packet = (SSimulationTickPacket *) packet_end;
-	packet_end += sizeof(*tick_packet);
-	tick_packet->sequence_num = curr_tick;
-	tick_packet->ack_input_sequence_num = dest_player->input_sequence_num;
-	tick_packet->your_player_id = dest_player->id;
-	tick_packet->game_settings.player_timeout = PLAYER_TIMEOUT;
-	tick_packet->game_settings.level_size = LEVEL_SIZE;
-	tick_packet->game_settings.fps = FPS;
-	tick_packet->game_settings.projectile_lifetime = PROJECTILE_LIFETIME;
-
-	// Array headers.
-	void *players_array = (char *) tick_packet +
-		offsetof(SSimulationTickPacket, players);
-	void *explosions_array = (char *) tick_packet +
-		offsetof(SSimulationTickPacket, explosions);
-	void *projectiles_array = (char *) tick_packet +
-		offsetof(SSimulationTickPacket, projectiles);
-
-	// Players.
-	s_array_init(players_array, packet_end, players.n_elems);
-	for (size_t i_player = 0; i_player < players.n_elems; i_player++) {
-		Player *player = vector_get(&players, i_player);
-		SPlayer *s_player = (SPlayer *) packet_end;
-		packet_end += sizeof(*s_player);
-		s_player->id = player->id;
-		s_player->alive = !!player->alive;
-		s_player->position = player->position;
-		s_player->heading = player->heading;
-		s_player->score = player->score;
-		s_player->color.red = player->color.red;
-		s_player->color.green = player->color.green;
-		s_player->color.blue = player->color.blue;
-	}
-
-	// Explosions.
-	s_array_init(explosions_array, packet_end, explosions.n_elems);
-	for (size_t i_expl = 0; i_expl < explosions.n_elems; i_expl++) {
-		Explosion *explosion = vector_get(&explosions, i_expl);
-		SExplosion *s_explosion = (SExplosion *) packet_end;
-		packet_end += sizeof(*s_explosion);
-		s_explosion->position = explosion->position;
-		s_explosion->n_ticks_since_creation =
-			curr_tick - explosion->creation_tick;
-	}
-
-	// Projectiles.
-	s_array_init(projectiles_array, packet_end, projectiles.n_elems);
-	for (size_t i_proj = 0; i_proj < projectiles.n_elems; i_proj++) {
-		Projectile *projectile = vector_get(&projectiles, i_proj);
-		SProjectile *s_projectile = (SProjectile *) packet_end;
-		packet_end += sizeof(*s_projectile);
-		s_projectile->position = projectile->position;
-		s_projectile->heading = projectile->heading;
-		s_projectile->n_ticks_since_creation =
-			curr_tick - projectile->creation_tick;
-	}
-
-	assert(packet_end == (char *) packet_begin + packet_size);
-
-	ssize_t n_sent_bytes =
-		sendto(handle, (const char*) packet_begin, packet_size, 0,
-		       (struct sockaddr *) &dest_player->address,
-		       sizeof(dest_player->address));
-
-	if (n_sent_bytes < 0 || (unsigned) n_sent_bytes != packet_size) {
-		perror("ERROR: Failed to send packet");
-		exit(EXIT_FAILURE);
+void encode_phase_stats(SPhaseStats *stats, enum Phase phase) {
+	Histogram *histogram = &profile.phases[phase];
+	SPhaseStats result;
+	memset(&result, 0, sizeof(result));
+	strncpy(result.name, PHASE_NAMES[phase], sizeof(result.name) - 1);
+	result.n_samples = histogram->n_values;
+	result.p50 = histogram_percentile(histogram, 50);
+	result.p99 = histogram_percentile(histogram, 99);
+	result.p999 = histogram_percentile(histogram, 99.9);
+	result.max = histogram->max;
+	memcpy(stats, &result, sizeof(result));
+}
+
+void encode_stats_reply(SStatsReplyPacket *reply, Cptime *last_stats_time) {
+	// Fill in everything but query_id and phases.
+
+	memset(reply, 0, sizeof(*reply));
+	Cptime time = cptime_time();
+	reply->uptime = cptime_elapsed(&start_time, &time);
+	reply->interval = cptime_elapsed(last_stats_time, &time);
+
+	// Receiver threads count their traffic separately.
+	CpsockStats net = lifetime_stats.net_stats;
+	cpsock_stats_add(&net, &net_stats);
+	reply->n_datagrams_received = net.n_datagrams_received
+		+ atomic_load(&receiver_traffic.n_datagrams_received);
+	reply->n_bytes_received = net.n_bytes_received
+		+ atomic_load(&receiver_traffic.n_bytes_received);
+	reply->n_datagrams_sent = net.n_datagrams_sent
+		+ atomic_load(&receiver_traffic.n_datagrams_sent);
+	reply->n_bytes_sent = net.n_bytes_sent
+		+ atomic_load(&receiver_traffic.n_bytes_sent);
+	reply->n_bad_protocol_id = atomic_load(&n_bad_packets.bad_protocol_id);
+	reply->n_bad_version = atomic_load(&n_bad_packets.bad_version);
+	reply->n_bad_type = atomic_load(&n_bad_packets.bad_type);
+	reply->n_bad_size = atomic_load(&n_bad_packets.bad_size);
+	reply->n_dropped_inputs = lifetime_stats.n_dropped_inputs
+		+ atomic_load(&n_dropped_inputs);
+	reply->n_send_timeouts = net.n_send_timeouts;
+	reply->n_ticks = lifetime_stats.n_ticks + tick_stats.n_ticks;
+	reply->n_overruns = lifetime_stats.n_overruns + tick_stats.n_overruns;
+	reply->n_dropped_ticks =
+		lifetime_stats.n_dropped_ticks + tick_stats.n_dropped_ticks;
+	reply->n_skipped_snapshots =
+		lifetime_stats.n_skipped_snapshots + tick_stats.n_skipped_snapshots;
+
+	for (int i_arena = 0; i_arena < N_ARENAS; i_arena++) {
+		World *world = &arenas[i_arena].world;
+		reply->n_players += slot_map_size(&world->players);
+		reply->n_projectiles += slot_map_size(&world->projectiles);
+		reply->n_explosions += ring_size(&world->explosions);
 	}
 }
 
+void answer_stats_queries(int handle, Cptime *last_stats_time) {
+	// Reply to the queued stats queries. Called on the main thread between ticks, while the network workers may still be sending the last snapshots: it must only read the arenas' worlds (which the workers don't touch, and the arena workers are idle) and statistics that belong to the main thread.
+
+	StatsQuery query;
+	if (!mpsc_queue_pop(&stats_queries, &query))
+		return;
+
+	unsigned char buffer[STATS_REPLY_SIZE];
+	s_packet_header_init(buffer, S_PT_STATS_REPLY);
+	SStatsReplyPacket reply;
+	encode_stats_reply(&reply, last_stats_time);
+	unsigned char *reply_data = buffer + sizeof(SPacketHeader);
+	SPhaseStats *phases = (SPhaseStats *) (reply_data + sizeof(reply));
+	for (int phase = 0; phase < N_PHASES; phase++)
+		encode_phase_stats(&phases[phase], phase);
+
+	do {
+		reply.query_id = query.query_id;
+		memcpy(reply_data, &reply, sizeof(reply));
+		s_array_init(reply_data + offsetof(SStatsReplyPacket, phases),
+		             phases, N_PHASES);
+
+		CpsockDatagram datagram;
+		datagram.address = query.address;
+		datagram.prefix = NULL;
+		datagram.prefix_size = 0;
+		datagram.data = buffer;
+		datagram.size = sizeof(buffer);
+		cpsock_send_all(handle, &datagram, 1, 0, &net_stats);
+	} while (mpsc_queue_pop(&stats_queries, &query));
+}
+
+void init_stats_queries(void) {
+	mpsc_queue_init(&stats_queries, sizeof(StatsQuery),
+	                STATS_QUERY_QUEUE_CAPACITY);
+	stats_query_keys =
+		malloc(N_STATS_QUERY_ADDRESSES * sizeof(CpsockAddressKey));
+	for (size_t i_key = 0; i_key < N_STATS_QUERY_ADDRESSES; i_key++) {
+		struct sockaddr_storage address;
+		if (!cpsock_ip_from_string(STATS_QUERY_ADDRESSES[i_key], &address)) {
+			fprintf(stderr, "ERROR: Invalid stats query address: %s.\n",
+			        STATS_QUERY_ADDRESSES[i_key]);
+			exit(EXIT_FAILURE);
+		}
+		stats_query_keys[i_key] =
+			cpsock_address_key((struct sockaddr *) &address);
+	}
+}
+
+void request_stats(int signal_number) {
+	(void) signal_number;
+	stats_requested = 1;
+}
+
 
 /// Main.
 
+void arena_init(Arena *arena, int index) {
+	arena->index = index;
+	world_init(&arena->world);
+	uint64_t seed;
+	random_bytes(&seed, sizeof(seed));
+	addr_map_init(&arena->player_addresses, seed);
+	mpsc_queue_init(&arena->inputs, sizeof(QueuedInput),
+	                INPUT_QUEUE_CAPACITY);
+	vector_init(&arena->new_sessions, sizeof(HandshakeReply));
+	snapshot_history_init(&arena->snapshot_history);
+	arena->capture_tick = 0;
+	vector_init(&arena->recipients, sizeof(Recipient));
+	vector_init(&arena->sessions, sizeof(HandshakeReply));
+	slot_map_init(&arena->interests, sizeof(InterestHistory));
+	vector_init(&arena->removed_interests, sizeof(SlotHandle));
+	if (INTEREST_RADIUS > 0) {
+		interest_index_init(&arena->interest_index, LEVEL_SIZE,
+		                    INTEREST_RADIUS, INTEREST_HYSTERESIS);
+	}
+	for (int i_encoded = 0; i_encoded < SNAPSHOT_HISTORY_LEN + 1;
+	     i_encoded++) {
+		arena->encoded[i_encoded].sequence_num = 0;
+		vector_init(&arena->encoded[i_encoded].data, 1);
+		vector_init(&arena->encoded[i_encoded].chunk_ends, sizeof(size_t));
+	}
+	memset(&arena->net_stats, 0, sizeof(arena->net_stats));
+	for (int phase = 0; phase < N_PHASES; phase++)
+		arena->phase_times[phase] = -1;
+}
+
+void simulate_arena(void *context, size_t i_arena) {
+	// Apply inputs and run one tick of an arena (called on the arena workers).
+	(void) context;
+	Arena *arena = &arenas[i_arena];
+	Cptime apply_start_time = cptime_time();
+	apply_queued_inputs(arena);
+	Cptime inputs_applied_time = cptime_time();
+	clean_up_disconnected_players(arena);
+	Cptime cleaned_up_time = cptime_time();
+	world_tick(&arena->world);
+	Cptime end_time = cptime_time();
+
+	arena_time_phase(arena, PHASE_APPLY_INPUTS,
+	                 &apply_start_time, &inputs_applied_time);
+	arena_time_phase(arena, PHASE_CLEAN_UP,
+	                 &inputs_applied_time, &cleaned_up_time);
+	arena_time_phase(arena, PHASE_SIMULATION, &cleaned_up_time, &end_time);
+}
+
+void capture_arena(void *context, size_t i_arena) {
+	(void) context;
+	Cptime capture_start_time = cptime_time();
+	capture_snapshot(&arenas[i_arena]);
+	Cptime end_time = cptime_time();
+	arena_time_phase(&arenas[i_arena], PHASE_CAPTURE,
+	                 &capture_start_time, &end_time);
+}
+
+// Snapshots sent by the network workers in one go.
+typedef struct SendJob {
+	int handle;
+	Cptime start_time;
+} SendJob;
+
+void send_arena(void *context, size_t i_arena) {
+	// Called on the network workers. Arenas share the time that the job may spend waiting for the socket.
+	SendJob *job = context;
+	Cptime time = cptime_time();
+	double time_left = MAX_SEND_WAIT - cptime_elapsed(&job->start_time, &time);
+	send_sim_tick_packets(&arenas[i_arena], job->handle, time_left);
+	Cptime end_time = cptime_time();
+	arena_time_phase(&arenas[i_arena], PHASE_SEND, &time, &end_time);
+}
+
 void main_loop(int handle) {
-	vector_init(&players, sizeof(Player));
-	vector_init(&explosions, sizeof(Explosion));
-	vector_init(&projectiles, sizeof(Projectile));
+	EventLoop loop;
+	// With receiver threads, the simulation thread only wakes up for ticks.
+	event_loop_init(&loop, (n_receiver_threads > 0) ? -1 : handle,
+	                1.0 / FPS, USE_EPOLL);
+	printf("Using %s event loop.\n", event_loop_implementation(&loop));
 
-	const double tick_interval = 1.0 / FPS;
-	double sleep_time = 0;
-	Cptime last_iter_time = cptime_time();
+	Cptime last_stats_time = cptime_time();
+	CpsockStats tick_start_net_stats = net_stats;
+	SendJob send_job;
+	send_job.handle = handle;
 
 	while (true) {
-		receive_packets(handle);
-		clean_up_disconnected_players();
-		tick_simulation();
-		for (size_t i_player = 0; i_player < players.n_elems; i_player++)
-			send_sim_tick_packet(handle, i_player);
+		unsigned long n_ticks;
+		int events = event_loop_wait(&loop, &n_ticks);
+		if (events == -1) {
+			perror("ERROR: Failed to wait for events");
+			exit(EXIT_FAILURE);
+		}
+
+		// Read inputs as soon as they arrive, so that they're applied in the very next tick. Once the receive budget is spent, stop watching the socket until the next tick.
+		if ((events & EVENT_LOOP_READABLE) && !receive_packets(handle)) {
+			event_loop_watch_socket(&loop, false);
+			tick_stats.n_receive_budget_exhausted++;
+		}
 
-		// Self-adjusting sleep that makes the loop contents execute every TICK_INTERVAL seconds.
-		Cptime this_iter_time = cptime_time();
-		double time_since_last_iter =
-			cptime_elapsed(&last_iter_time, &this_iter_time);
-		last_iter_time = this_iter_time;
-		sleep_time += tick_interval - time_since_last_iter;
-		if (sleep_time > 0)
-			cptime_sleep(sleep_time);
+		// If we've fallen behind, run the missed ticks back to back (up to a limit).
+		unsigned long n_ticks_to_run = update_overload(n_ticks);
+		if (n_ticks_to_run > 0) {
+			Cptime flush_start_time = cptime_time();
+			inbox_flush(&main_inbox);
+			Cptime flush_end_time = cptime_time();
+			histogram_record(&profile.phases[PHASE_QUEUE_INPUTS],
+			                 elapsed_ns(&flush_start_time, &flush_end_time));
+			histogram_record(&profile.phases[PHASE_RECEIVE],
+			                 receive_budget.time * 1e9);
+			memset(&receive_budget, 0, sizeof(receive_budget));
+			event_loop_watch_socket(&loop, true);
+		}
+		for (unsigned long i_tick = 0; i_tick < n_ticks_to_run; i_tick++) {
+			Cptime tick_start_time = cptime_time();
+
+			// Simulate this tick while the network workers are still sending the previous one.
+			work_pool_run(&arena_workers, simulate_arena, NULL, N_ARENAS);
+
+			// Capturing overwrites the oldest snapshot in the history, which may be a baseline that's still being used, so first wait for the sends to finish.
+			Cptime wait_start_time = cptime_time();
+			work_pool_wait(&network_workers);
+			Cptime wait_end_time = cptime_time();
+			histogram_record(&profile.phases[PHASE_WAIT_FOR_SENDS],
+			                 elapsed_ns(&wait_start_time, &wait_end_time));
+			for (int i_arena = 0; i_arena < N_ARENAS; i_arena++) {
+				cpsock_stats_add(&net_stats, &arenas[i_arena].net_stats);
+				memset(&arenas[i_arena].net_stats, 0, sizeof(CpsockStats));
+			}
+			collect_arena_profiles();
+			if (should_send_snapshot(i_tick + 1 < n_ticks_to_run)) {
+				work_pool_run(&arena_workers, capture_arena, NULL, N_ARENAS);
+				send_job.start_time = cptime_time();
+				work_pool_start(&network_workers, send_arena, &send_job,
+				                N_ARENAS);
+			}
+			Cptime tick_end_time = cptime_time();
+			update_tick_stats(&tick_start_net_stats,
+			                  cptime_elapsed(&tick_start_time, &tick_end_time));
+			histogram_record(&profile.phases[PHASE_TICK],
+			                 elapsed_ns(&tick_start_time, &tick_end_time));
+
+			if (stats_requested || (STATS_INTERVAL > 0
+			    && cptime_elapsed(&last_stats_time, &tick_end_time)
+			       >= STATS_INTERVAL)) {
+				stats_requested = 0;
+				print_stats();
+				last_stats_time = tick_end_time;
+			}
+			answer_stats_queries(handle, &last_stats_time);
+			tick_start_net_stats = net_stats;
+		}
 	}
 }
 
-int main() {
-	srand(time(NULL));
-	cpsock_initialize();
+int open_socket(bool reuse_port) {
+	// Create a non-blocking UDP socket bound to LISTEN_PORT. Return value: the socket, or -1 if reuse_port was requested but isn't supported.
 
 	int handle = socket((USE_IPV6 ? AF_INET6 : AF_INET),
 	                    SOCK_DGRAM, IPPROTO_UDP);
@@ -605,6 +1457,11 @@ int main() {
 		exit(EXIT_FAILURE);
 	}
 
+	if (reuse_port && !cpsock_set_reuse_port(handle)) {
+		cpsock_close(handle);
+		return -1;
+	}
+
 	struct sockaddr_storage address;
 	memset(&address, 0, sizeof(address));
 	if (USE_IPV6) {
@@ -624,6 +1481,87 @@ int main() {
 		exit(EXIT_FAILURE);
 	}
 
+	return handle;
+}
+
+int start_receiver_threads(int n_threads) {
+	// Give each receiver thread its own SO_REUSEPORT socket. Return value: the socket that the simulation thread should send from (the first receiver's), or -1 if SO_REUSEPORT isn't supported.
+
+	int send_handle = -1;
+	for (int i_thread = 0; i_thread < n_threads; i_thread++) {
+		int handle = open_socket(true);
+		if (handle == -1)
+			return -1; // Only possible for the first socket.
+		if (i_thread == 0)
+			send_handle = handle;
+
+		Cpthread thread;
+		if (!cpthread_create(&thread, receiver_thread,
+		                     (void *) (intptr_t) handle)) {
+			perror("ERROR: Failed to start receiver thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	n_receiver_threads = n_threads;
+	return send_handle;
+}
+
+int main() {
+	srand(time(NULL));
+	cpsock_initialize();
+
+	bool batched_io = cpsock_set_batching(USE_BATCHED_IO);
+	printf("Using %s.\n", batched_io ? "batched I/O (recvmmsg/sendmmsg)"
+	                                 : "unbatched I/O (recvfrom/sendto)");
+	printf("Using %s projectile integration.\n", kinematics_implementation());
+
+	if (!logger_init(&logger, LOG_CAPACITY, LOG_CLASSES, N_LOG_CLASSES)) {
+		perror("ERROR: Failed to start the log writer thread");
+		exit(EXIT_FAILURE);
+	}
+	start_time = cptime_time();
+	random_bytes(&handshake_key, sizeof(handshake_key));
+	inbox_init(&main_inbox);
+	init_stats_queries();
+#if !defined(PLATFORM_WINDOWS)
+	struct sigaction stats_action;
+	memset(&stats_action, 0, sizeof(stats_action));
+	stats_action.sa_handler = request_stats;
+	sigemptyset(&stats_action.sa_mask);
+	sigaction(SIGUSR1, &stats_action, NULL);
+#endif
+	arenas = malloc(N_ARENAS * sizeof(Arena));
+	for (int i_arena = 0; i_arena < N_ARENAS; i_arena++)
+		arena_init(&arenas[i_arena], i_arena);
+	if (!work_pool_init(&arena_workers, N_WORKER_THREADS)
+	    || !work_pool_init(&network_workers, N_NETWORK_THREADS)) {
+		perror("ERROR: Failed to start worker threads");
+		exit(EXIT_FAILURE);
+	}
+	printf("Hosting %d arenas on %d threads, sending snapshots on %d.\n",
+	       N_ARENAS, N_WORKER_THREADS + 1, N_NETWORK_THREADS);
+	if (INTEREST_RADIUS > 0) {
+		printf("Sending entities within %g pixels of each player.\n",
+		       INTEREST_RADIUS);
+	}
+
+	int handle = -1;
+	if (N_RECEIVER_THREADS > 0) {
+		handle = start_receiver_threads(N_RECEIVER_THREADS);
+		if (handle == -1)
+			fprintf(stderr, "WARNING: SO_REUSEPORT isn't supported,"
+			        " reading inputs on the simulation thread.\n");
+		else
+			printf("Reading inputs on %d receiver threads.\n",
+			       n_receiver_threads);
+	}
+	if (handle == -1)
+		handle = open_socket(false);
+
+	struct sockaddr_storage address;
+	socklen_t address_size = sizeof(address);
+	getsockname(handle, (struct sockaddr *) &address, &address_size);
 	char address_str[CPSOCK_IP_TO_STRING_LEN];
 	cpsock_ip_to_string((struct sockaddr *) &address,
 	                    address_str, sizeof(address_str));
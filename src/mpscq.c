@@ -0,0 +1,85 @@
+#include "mpscq.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static atomic_size_t *slot_sequence(MpscQueue *queue, size_t position) {
+	size_t i_slot = position & (queue->capacity - 1);
+	return (atomic_size_t *) (queue->slots + i_slot * queue->slot_size);
+}
+
+static void *slot_elem(atomic_size_t *sequence) {
+	return (char *) sequence + sizeof(atomic_size_t);
+}
+
+void mpsc_queue_init(MpscQueue *queue, size_t elem_size, size_t capacity) {
+	// capacity is rounded up to a power of 2.
+	assert(elem_size > 0);
+	assert(capacity > 0);
+
+	queue->elem_size = elem_size;
+	queue->capacity = 1;
+	while (queue->capacity < capacity)
+		queue->capacity *= 2;
+
+	// Round the slot size up so that every sequence number is aligned.
+	size_t align = _Alignof(atomic_size_t);
+	queue->slot_size = (sizeof(atomic_size_t) + elem_size + align - 1)
+		/ align * align;
+	queue->slots = malloc(queue->capacity * queue->slot_size);
+
+	// A slot at position p is free for the producer that claims p when its sequence is p, and holds an element for the consumer when its sequence is p + 1.
+	for (size_t i_slot = 0; i_slot < queue->capacity; i_slot++)
+		atomic_init(slot_sequence(queue, i_slot), i_slot);
+	atomic_init(&queue->tail, 0);
+	queue->head = 0;
+}
+
+bool mpsc_queue_push(MpscQueue *queue, const void *elem) {
+	// Safe to call from any number of threads at once. Return value: false if the queue is full.
+
+	size_t position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	atomic_size_t *sequence;
+	while (true) {
+		sequence = slot_sequence(queue, position);
+		size_t seq = atomic_load_explicit(sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t) seq - (intptr_t) position;
+		if (difference == 0) {
+			// The slot is free, try to claim it. On failure, position is updated to the current tail.
+			if (atomic_compare_exchange_weak_explicit(
+				    &queue->tail, &position, position + 1,
+				    memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (difference < 0) {
+			// The consumer hasn't popped the element a full lap behind us yet.
+			return false;
+		} else {
+			// Another producer claimed the slot first.
+			position = atomic_load_explicit(&queue->tail,
+			                                memory_order_relaxed);
+		}
+	}
+
+	memcpy(slot_elem(sequence), elem, queue->elem_size);
+	atomic_store_explicit(sequence, position + 1, memory_order_release);
+	return true;
+}
+
+bool mpsc_queue_pop(MpscQueue *queue, void *elem) {
+	// Only one thread may pop. Return value: false if the queue is empty (or the oldest element is still being written).
+
+	atomic_size_t *sequence = slot_sequence(queue, queue->head);
+	size_t seq = atomic_load_explicit(sequence, memory_order_acquire);
+	if (seq != queue->head + 1)
+		return false;
+
+	memcpy(elem, slot_elem(sequence), queue->elem_size);
+	atomic_store_explicit(sequence, queue->head + queue->capacity,
+	                      memory_order_release);
+	queue->head++;
+	return true;
+}
@@ -0,0 +1,26 @@
+// Bounded lock-free queue for passing objects from many producer threads to one consumer thread.
+// Each slot carries a sequence number that tells producers whether it's free and the consumer whether it's been filled, so pushing is a single compare-and-swap on the tail and popping needs no atomic read-modify-write at all. Pushing to a full queue fails instead of blocking.
+
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+enum { MPSC_QUEUE_CACHE_LINE = 64 };
+
+typedef struct MpscQueue {
+	char *slots; // Each: an atomic_size_t sequence number followed by the element.
+	size_t elem_size;
+	size_t slot_size;
+	size_t capacity; // Power of 2.
+
+	// Written by producers and the consumer respectively, so kept on separate cache lines.
+	_Alignas(MPSC_QUEUE_CACHE_LINE) atomic_size_t tail;
+	_Alignas(MPSC_QUEUE_CACHE_LINE) size_t head;
+} MpscQueue;
+
+void mpsc_queue_init(MpscQueue *queue, size_t elem_size, size_t capacity);
+
+bool mpsc_queue_push(MpscQueue *queue, const void *elem);
+
+bool mpsc_queue_pop(MpscQueue *queue, void *elem);
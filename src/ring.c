@@ -0,0 +1,73 @@
+#include "ring.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+enum { RING_INITIAL_N_ALLOCATED = 16 };
+
+void ring_init(Ring *ring, size_t elem_size) {
+	assert(elem_size > 0);
+	ring->elem_size = elem_size;
+	ring->n_allocated = RING_INITIAL_N_ALLOCATED;
+	ring->array = malloc(ring->n_allocated * elem_size);
+	ring->i_front = 0;
+	ring->n_elems = 0;
+}
+
+size_t ring_size(Ring *ring) {
+	return ring->n_elems;
+}
+
+void *ring_get(Ring *ring, size_t i_elem) {
+	assert(i_elem < ring->n_elems);
+	size_t i_array = (ring->i_front + i_elem) & (ring->n_allocated - 1);
+	return (char *) ring->array + i_array * ring->elem_size;
+}
+
+void *ring_front(Ring *ring) {
+	return ring_get(ring, 0);
+}
+
+static void ring_grow(Ring *ring) {
+	// Double the capacity, unwrapping the elements so that the front is at index 0.
+	size_t n_allocated = ring->n_allocated * 2;
+	char *array = malloc(n_allocated * ring->elem_size);
+
+	size_t n_before_wrap = ring->n_allocated - ring->i_front;
+	if (n_before_wrap > ring->n_elems)
+		n_before_wrap = ring->n_elems;
+	memcpy(array, (char *) ring->array + ring->i_front * ring->elem_size,
+	       n_before_wrap * ring->elem_size);
+	memcpy(array + n_before_wrap * ring->elem_size, ring->array,
+	       (ring->n_elems - n_before_wrap) * ring->elem_size);
+
+	free(ring->array);
+	ring->array = array;
+	ring->n_allocated = n_allocated;
+	ring->i_front = 0;
+}
+
+void ring_push(Ring *ring, const void *elem) {
+	if (ring->n_elems == ring->n_allocated)
+		ring_grow(ring);
+	ring->n_elems++;
+	memcpy(ring_get(ring, ring->n_elems - 1), elem, ring->elem_size);
+}
+
+void ring_pop(Ring *ring) {
+	assert(ring->n_elems > 0);
+	ring->i_front = (ring->i_front + 1) & (ring->n_allocated - 1);
+	ring->n_elems--;
+}
+
+void ring_copy(Ring *dest, Ring *src) {
+	// Make dest (an initialized ring) a copy of src.
+	assert(dest->elem_size == src->elem_size);
+	while (dest->n_allocated < src->n_elems)
+		ring_grow(dest);
+	dest->i_front = 0;
+	dest->n_elems = src->n_elems;
+	for (size_t i_elem = 0; i_elem < src->n_elems; i_elem++)
+		memcpy(ring_get(dest, i_elem), ring_get(src, i_elem), src->elem_size);
+}
@@ -0,0 +1,27 @@
+// Growable FIFO ring buffer (a queue with O(1) push at the back and pop at the front).
+// Suited to objects that are destroyed in the order they were created, e.g. ones with a fixed lifetime. Indices are relative to the front, so iterating from 0 to ring_size() - 1 goes from the oldest element to the newest, and popping from the front renumbers the rest.
+
+#pragma once
+#include <stddef.h>
+
+typedef struct Ring {
+	void *array;
+	size_t elem_size;
+	size_t n_allocated; // Power of 2.
+	size_t i_front; // Index in array of the oldest element.
+	size_t n_elems;
+} Ring;
+
+void ring_init(Ring *ring, size_t elem_size);
+
+size_t ring_size(Ring *ring);
+
+void *ring_get(Ring *ring, size_t i_elem);
+
+void *ring_front(Ring *ring);
+
+void ring_push(Ring *ring, const void *elem);
+
+void ring_pop(Ring *ring);
+
+void ring_copy(Ring *dest, Ring *src);
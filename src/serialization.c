@@ -1,11 +1,17 @@
 #include "serialization.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 
+#if !defined(M_PI)
+#define M_PI 3.14159265358979323846264338327
+#endif
+
 const SProtocolId S_PROTOCOL_ID = 0xEC3B5FA9; // Randomly chosen.
-const SVersion S_PROTOCOL_VERSION = {7, 0};
+const SVersion S_PROTOCOL_VERSION = {12, 2};
 
 void s_swap_endianness(void *target, size_t size) {
 	char *first = target;
@@ -81,3 +87,62 @@ void s_packet_header_init(void *header, SPacketType type) {
 	result.type = type;
 	memcpy(header, &result, sizeof(result));
 }
+
+
+/// Quantization.
+
+static uint16_t coordinate_encode(float coordinate, int32_t level_extent) {
+	// Positions at the far edge wrap around to 0, like in the game.
+	long encoded = lround(coordinate / level_extent * 65536.0);
+	return (uint16_t) (encoded & 0xFFFF);
+}
+
+SPosition s_position_encode(SVectorFloat position, SVectorInt level_size) {
+	SPosition result;
+	result.x = coordinate_encode(position.x, level_size.x);
+	result.y = coordinate_encode(position.y, level_size.y);
+	return result;
+}
+
+SVectorFloat s_position_decode(SPosition position, SVectorInt level_size) {
+	SVectorFloat result;
+	result.x = position.x * (level_size.x / 65536.0f);
+	result.y = position.y * (level_size.y / 65536.0f);
+	return result;
+}
+
+static int16_t velocity_component_encode(float component) {
+	float scaled = roundf(component * (1 << S_VELOCITY_FRACTION_BITS));
+	return (int16_t) fmaxf(INT16_MIN, fminf(INT16_MAX, scaled));
+}
+
+SVelocity s_velocity_encode(SVectorFloat velocity) {
+	SVelocity result;
+	result.x = velocity_component_encode(velocity.x);
+	result.y = velocity_component_encode(velocity.y);
+	return result;
+}
+
+SVectorFloat s_velocity_decode(SVelocity velocity) {
+	SVectorFloat result;
+	result.x = (float) velocity.x / (1 << S_VELOCITY_FRACTION_BITS);
+	result.y = (float) velocity.y / (1 << S_VELOCITY_FRACTION_BITS);
+	return result;
+}
+
+uint16_t s_heading_encode(float heading, int n_bits) {
+	// Any heading is accepted, turns are wrapped around.
+	assert(n_bits > 0 && n_bits <= 16);
+	double turns = heading / (2 * M_PI);
+	long encoded = lround((turns - floor(turns)) * (1L << n_bits));
+	return (uint16_t) (encoded & ((1L << n_bits) - 1));
+}
+
+float s_heading_decode(uint16_t heading, int n_bits) {
+	return heading * (2 * M_PI / (1L << n_bits));
+}
+
+STickAge s_tick_age_encode(int n_ticks) {
+	assert(n_ticks >= 0);
+	return (n_ticks > UINT8_MAX) ? UINT8_MAX : n_ticks;
+}
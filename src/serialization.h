@@ -73,13 +73,18 @@ typedef struct SVersion {
 	uint16_t minor;
 } SVersion;
 
-const SProtocolId S_PROTOCOL_ID;
-const SVersion S_PROTOCOL_VERSION;
+extern const SProtocolId S_PROTOCOL_ID;
+extern const SVersion S_PROTOCOL_VERSION;
 
 typedef int8_t SPacketType;
 enum SPacketType {
 	S_PT_SIMULATION_TICK,
 	S_PT_PLAYER_INPUT,
+	S_PT_CONNECT,
+	S_PT_CHALLENGE,
+	S_PT_SESSION,
+	S_PT_STATS_QUERY,
+	S_PT_STATS_REPLY,
 };
 
 typedef struct SPacketHeader {
@@ -117,30 +122,104 @@ typedef struct SPlayerInput {
 	bool shoot;
 } SPlayerInput;
 
+// Entities in simulation ticks are quantized to make them smaller. Use the s_*_encode and s_*_decode functions below to convert them.
+
+// Fractions of level_size in 1 / 2^16 (a 16-bit fixed-point number in [0, 1)): x = encoded.x * level_size.x / 2^16, and likewise for y.
+typedef struct SPosition {
+	uint16_t x;
+	uint16_t y;
+} SPosition;
+
+// Pixels / tick in 1 / 2^10 (a signed fixed-point number): x = encoded.x / 2^10, and likewise for y.
+typedef struct SVelocity {
+	int16_t x;
+	int16_t y;
+} SVelocity;
+
+enum { S_VELOCITY_FRACTION_BITS = 10 };
+
+// Headings are fractions of a full turn: heading = encoded * 2 * pi / 2^n_bits.
+enum { S_PLAYER_HEADING_BITS = 10 };
+enum { S_PROJECTILE_HEADING_BITS = 8 };
+
+// Ages of entities in ticks, saturating at 255 (longer than anything lives).
+typedef uint8_t STickAge;
+
+// Bits of SPlayer.heading_and_flags.
+enum {
+	S_PLAYER_HEADING_MASK = (1 << S_PLAYER_HEADING_BITS) - 1,
+	S_PLAYER_ALIVE = 1 << S_PLAYER_HEADING_BITS,
+};
+
 typedef struct SPlayer {
 	SPlayerId id;
-	SBool alive;
-	SVectorFloat position;
-	float heading;
+	SPosition position;
+	uint16_t heading_and_flags; // Heading in the low S_PLAYER_HEADING_BITS bits, S_PLAYER_ALIVE above it.
 	uint32_t score;
 	SColor color;
 } SPlayer;
 
+typedef uint32_t SEntityId; // IDs of explosions and projectiles (never reused).
+
 typedef struct SExplosion {
-	SVectorFloat position;
-	uint16_t n_ticks_since_creation;
+	SEntityId id;
+	SPosition position;
+	STickAge n_ticks_since_creation;
 } SExplosion;
 
 typedef struct SProjectile {
-	SVectorFloat position;
-	float heading;
-	uint16_t n_ticks_since_creation;
+	SEntityId id;
+	SPosition position;
+	SVelocity velocity;
+	uint8_t heading; // S_PROJECTILE_HEADING_BITS bits.
+	STickAge n_ticks_since_creation;
 } SProjectile;
 
+SPosition s_position_encode(SVectorFloat position, SVectorInt level_size);
+SVectorFloat s_position_decode(SPosition position, SVectorInt level_size);
+SVelocity s_velocity_encode(SVectorFloat velocity);
+SVectorFloat s_velocity_decode(SVelocity velocity);
+uint16_t s_heading_encode(float heading, int n_bits);
+float s_heading_decode(uint16_t heading, int n_bits);
+STickAge s_tick_age_encode(int n_ticks);
+
 typedef uint64_t SSequenceNum;
 
+typedef uint16_t SArenaId;
+
+// Clients join an arena with a handshake, so that players are only created for addresses that can receive packets (and not for spoofed ones):
+// 1. The client sends an S_PT_CONNECT packet with the arena_id and a cookie of 0.
+// 2. The server replies with an S_PT_CHALLENGE packet containing a cookie. The server doesn't remember it, but can tell that it made it for this address and arena in the last several seconds.
+// 3. The client sends the S_PT_CONNECT packet again, with the cookie.
+// 4. The server adds the player and replies with an S_PT_SESSION packet containing the token to put in its inputs. A client that is already in the arena is sent its existing session.
+// Any of these packets may get lost, so the client should resend its S_PT_CONNECT packet every so often until it gets a session. If the cookie has expired by then, it gets a new challenge instead. A challenge is no bigger than the connect packet that it answers, so the server can't be used to amplify floods.
+
+typedef uint64_t SCookie; // 0 means none.
+
+typedef struct SConnectPacket {
+	SArenaId arena_id; // Match to play in. A client stays in an arena until it times out there.
+	SCookie cookie; // From the server's challenge.
+} SConnectPacket;
+
+typedef struct SChallengePacket {
+	SArenaId arena_id;
+	SCookie cookie;
+} SChallengePacket;
+
+typedef struct SSessionToken {
+	SArenaId arena_id;
+	uint32_t player_handle; // Identifies the player within the arena.
+	uint64_t secret;
+} SSessionToken;
+
+typedef struct SSessionPacket {
+	SSessionToken token;
+} SSessionPacket;
+
 typedef struct SPlayerInputPacket {
 	SSequenceNum sequence_num;
+	SSequenceNum ack_sim_tick_sequence_num; // Newest simulation tick that the client has decoded (0 if none).
+	SSessionToken session; // From the server's S_PT_SESSION packet. Inputs from any other address than the one that connected are ignored.
 	SPlayerInput input;
 } SPlayerInputPacket;
 
@@ -151,15 +230,78 @@ typedef struct SGameSettings {
 	uint16_t projectile_lifetime;
 } SGameSettings;
 
+// Simulation ticks are delta-compressed against a baseline: a tick that the client has acknowledged in ack_sim_tick_sequence_num, baseline_age ticks before this one. To decode a tick, the client takes its copy of the baseline tick and:
+// - advances every projectile by baseline_age ticks (adding its decoded velocity to its decoded position and wrapping around the level edges after each one, without quantizing in between) and ages it and every explosion by the same number of ticks (saturating at 255),
+// - deletes the entities listed in the removed_* arrays,
+// - adds or replaces the entities in the players, explosions and projectiles arrays (matching them by id).
+// If baseline_age is 0, the packet is a full snapshot and the client starts from an empty world. The client should keep the ticks it decoded for a while (the server uses baselines up to about a second old).
+// So that packets don't get fragmented, a tick may be split into n_chunks packets, numbered by chunk_index. Each one is complete on its own, with the same header fields and a separate part of the arrays, so chunks can be applied in any order as they arrive (the baseline is only advanced once per tick, before the first one). A tick must only be acknowledged once all of its chunks have been applied.
 typedef struct SSimulationTickPacket {
 	SSequenceNum sequence_num;
+	uint8_t baseline_age; // sequence_num of the baseline is sequence_num - baseline_age.
+	uint16_t chunk_index;
+	uint16_t n_chunks;
 	SSequenceNum ack_input_sequence_num;
 	SGameSettings game_settings;
 	SPlayerId your_player_id;
-	SArray players; // Array of SPlayer.
-	SArray explosions; // Array of SExplosion.
-	SArray projectiles; // Array of SProjectile.
+	SArray players; // Array of SPlayer (added or changed since the baseline).
+	SArray removed_player_ids; // Array of SPlayerId.
+	SArray explosions; // Array of SExplosion (added since the baseline).
+	SArray removed_explosion_ids; // Array of SEntityId.
+	SArray projectiles; // Array of SProjectile (added since the baseline).
+	SArray removed_projectile_ids; // Array of SEntityId.
 } SSimulationTickPacket;
 
 
+/// Statistics, for monitoring a running server. It only answers queries from the addresses it's configured to.
+
+// Durations of a part of the server's work on ticks, in nanoseconds.
+typedef struct SPhaseStats {
+	char name[16]; // Null-terminated.
+	uint32_t n_samples;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+} SPhaseStats;
+
+typedef struct SStatsReplyPacket {
+	uint32_t query_id;
+	float uptime; // Seconds.
+	float interval; // Seconds that phases cover (since the server last printed its statistics).
+
+	// Totals since startup.
+	uint64_t n_datagrams_received;
+	uint64_t n_bytes_received;
+	uint64_t n_datagrams_sent;
+	uint64_t n_bytes_sent;
+	uint64_t n_bad_protocol_id; // Received datagrams dropped, by reason.
+	uint64_t n_bad_version;
+	uint64_t n_bad_type;
+	uint64_t n_bad_size;
+	uint64_t n_dropped_inputs; // Because the queue of their arena was full.
+	uint64_t n_send_timeouts; // Datagrams not sent because the send buffer stayed full.
+	uint64_t n_ticks;
+	uint64_t n_overruns; // Wakeups that found more than one tick due.
+	uint64_t n_dropped_ticks;
+	uint64_t n_skipped_snapshots;
+
+	// Now, in all arenas together.
+	uint32_t n_players;
+	uint32_t n_projectiles;
+	uint32_t n_explosions;
+
+	SArray phases; // Array of SPhaseStats.
+} SStatsReplyPacket;
+
+enum { S_STATS_MAX_PHASES = 16 }; // In a reply.
+
+// Queries are padded to the size of the biggest possible reply, and the server ignores any that are smaller than its reply. Otherwise, queries with a spoofed source address would make it send floods bigger than the ones it receives (like the handshake, it never amplifies).
+typedef struct SStatsQueryPacket {
+	uint32_t query_id; // Copied to the reply.
+	uint8_t padding[sizeof(SStatsReplyPacket) - sizeof(uint32_t)
+	                + S_STATS_MAX_PHASES * sizeof(SPhaseStats)]; // Zeros.
+} SStatsQueryPacket;
+
+
 #pragma pack(pop)
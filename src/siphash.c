@@ -0,0 +1,67 @@
+#include "siphash.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Reference: Aumasson and Bernstein, "SipHash: a fast short-input PRF" (2012).
+
+static uint64_t rotate_left(uint64_t x, int n_bits) {
+	return (x << n_bits) | (x >> (64 - n_bits));
+}
+
+static uint64_t read_le64(const unsigned char *bytes) {
+	// Messages are read as little-endian words on any machine, so that the output doesn't depend on it.
+	uint64_t result = 0;
+	for (int i_byte = 7; i_byte >= 0; i_byte--)
+		result = (result << 8) | bytes[i_byte];
+	return result;
+}
+
+static void sip_round(uint64_t v[4]) {
+	v[0] += v[1];
+	v[1] = rotate_left(v[1], 13);
+	v[1] ^= v[0];
+	v[0] = rotate_left(v[0], 32);
+	v[2] += v[3];
+	v[3] = rotate_left(v[3], 16);
+	v[3] ^= v[2];
+	v[0] += v[3];
+	v[3] = rotate_left(v[3], 21);
+	v[3] ^= v[0];
+	v[2] += v[1];
+	v[1] = rotate_left(v[1], 17);
+	v[1] ^= v[2];
+	v[2] = rotate_left(v[2], 32);
+}
+
+static void sip_compress(uint64_t v[4], uint64_t word) {
+	v[3] ^= word;
+	sip_round(v);
+	sip_round(v);
+	v[0] ^= word;
+}
+
+uint64_t siphash(const SipHashKey *key, const void *data, size_t size) {
+	uint64_t v[4] = {
+		key->k0 ^ 0x736F6D6570736575ULL,
+		key->k1 ^ 0x646F72616E646F6DULL,
+		key->k0 ^ 0x6C7967656E657261ULL,
+		key->k1 ^ 0x7465646279746573ULL,
+	};
+
+	const unsigned char *bytes = data;
+	size_t n_full_words = size / 8;
+	for (size_t i_word = 0; i_word < n_full_words; i_word++)
+		sip_compress(v, read_le64(bytes + i_word * 8));
+
+	// The last word holds the leftover bytes and the message size.
+	unsigned char last[8] = {0};
+	for (size_t i_byte = n_full_words * 8; i_byte < size; i_byte++)
+		last[i_byte % 8] = bytes[i_byte];
+	last[7] = (unsigned char) size;
+	sip_compress(v, read_le64(last));
+
+	v[2] ^= 0xFF;
+	for (int i_round = 0; i_round < 4; i_round++)
+		sip_round(v);
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
@@ -0,0 +1,13 @@
+// SipHash-2-4: a keyed hash of short messages, used as a MAC.
+// Without the key, its output can't be predicted or forged, so it's suitable for things like handshake cookies (unlike the hashes in hash tables).
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct SipHashKey {
+	uint64_t k0;
+	uint64_t k1;
+} SipHashKey;
+
+uint64_t siphash(const SipHashKey *key, const void *data, size_t size);
@@ -0,0 +1,115 @@
+#include "slotmap.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include "vector.h"
+
+enum { SLOT_MAP_INDEX_BITS = 20 }; // Up to ~1M elements.
+#define SLOT_MAP_INDEX_MASK ((1u << SLOT_MAP_INDEX_BITS) - 1)
+#define SLOT_MAP_MAX_GENERATION ((1u << (32 - SLOT_MAP_INDEX_BITS)) - 1)
+enum { SLOT_MAP_NO_SLOT = UINT32_MAX };
+
+typedef struct SlotMapSlot {
+	uint32_t i_elem; // If free: index of the next free slot (or SLOT_MAP_NO_SLOT).
+	uint32_t generation; // Odd if the slot is used, even if it's free.
+} SlotMapSlot;
+
+static SlotHandle slot_map_make_handle(uint32_t i_slot, uint32_t generation) {
+	return (generation << SLOT_MAP_INDEX_BITS) | i_slot;
+}
+
+void slot_map_init(SlotMap *map, size_t elem_size) {
+	vector_init(&map->elems, elem_size);
+	vector_init(&map->elem_slots, sizeof(uint32_t));
+	vector_init(&map->slots, sizeof(SlotMapSlot));
+	map->first_free_slot = SLOT_MAP_NO_SLOT;
+}
+
+size_t slot_map_size(SlotMap *map) {
+	return map->elems.n_elems;
+}
+
+void *slot_map_at(SlotMap *map, size_t i_elem) {
+	// Elements are numbered 0..slot_map_size()-1. Removing an element renumbers the last one.
+	return vector_get(&map->elems, i_elem);
+}
+
+SlotHandle slot_map_handle_at(SlotMap *map, size_t i_elem) {
+	uint32_t i_slot = *(uint32_t *) vector_get(&map->elem_slots, i_elem);
+	SlotMapSlot *slot = vector_get(&map->slots, i_slot);
+	return slot_map_make_handle(i_slot, slot->generation);
+}
+
+static SlotMapSlot *slot_map_slot(SlotMap *map, SlotHandle handle) {
+	// Return value: the slot of a handle, NULL if the handle is stale or invalid.
+	uint32_t i_slot = handle & SLOT_MAP_INDEX_MASK;
+	uint32_t generation = handle >> SLOT_MAP_INDEX_BITS;
+	if (i_slot >= map->slots.n_elems)
+		return NULL;
+	SlotMapSlot *slot = vector_get(&map->slots, i_slot);
+	return (slot->generation == generation && generation % 2 == 1)
+		? slot : NULL;
+}
+
+void *slot_map_get(SlotMap *map, SlotHandle handle) {
+	// Return value: the element, NULL if it has been removed.
+	SlotMapSlot *slot = slot_map_slot(map, handle);
+	return (slot == NULL) ? NULL : vector_get(&map->elems, slot->i_elem);
+}
+
+SlotHandle slot_map_insert(SlotMap *map, const void *elem) {
+	uint32_t i_slot = map->first_free_slot;
+	SlotMapSlot *slot;
+	if (i_slot != SLOT_MAP_NO_SLOT) {
+		slot = vector_get(&map->slots, i_slot);
+		map->first_free_slot = slot->i_elem;
+	} else {
+		assert(map->slots.n_elems <= SLOT_MAP_INDEX_MASK);
+		i_slot = map->slots.n_elems;
+		vector_resize(&map->slots, map->slots.n_elems + 1);
+		slot = vector_get(&map->slots, i_slot);
+		slot->generation = 0;
+	}
+
+	// Make the generation odd (used). Wrapping around skips 0, so that SLOT_HANDLE_NONE is never valid.
+	slot->generation = (slot->generation + 1) & SLOT_MAP_MAX_GENERATION;
+	slot->i_elem = map->elems.n_elems;
+	vector_push(&map->elems, elem);
+	vector_push(&map->elem_slots, &i_slot);
+
+	return slot_map_make_handle(i_slot, slot->generation);
+}
+
+size_t slot_map_remove(SlotMap *map, SlotHandle handle) {
+	// Remove an element by moving the last one into its place.
+	// Return value: the index of the removed element, which now holds the element that was last (unless the removed one was last itself). When removing elements while iterating over them, process that index again.
+
+	SlotMapSlot *slot = slot_map_slot(map, handle);
+	assert(slot != NULL);
+	uint32_t i_slot = handle & SLOT_MAP_INDEX_MASK;
+	uint32_t i_elem = slot->i_elem;
+	uint32_t i_last = map->elems.n_elems - 1;
+
+	if (i_elem != i_last) {
+		uint32_t last_slot = *(uint32_t *) vector_get(&map->elem_slots, i_last);
+		vector_set(&map->elems, i_elem, vector_get(&map->elems, i_last));
+		vector_set(&map->elem_slots, i_elem, &last_slot);
+		((SlotMapSlot *) vector_get(&map->slots, last_slot))->i_elem = i_elem;
+	}
+	vector_pop(&map->elems);
+	vector_pop(&map->elem_slots);
+
+	slot->generation = (slot->generation + 1) & SLOT_MAP_MAX_GENERATION; // Even (free).
+	slot->i_elem = map->first_free_slot;
+	map->first_free_slot = i_slot;
+
+	return i_elem;
+}
+
+void slot_map_copy(SlotMap *dest, SlotMap *src) {
+	// Make dest (an initialized slot map) a copy of src, with the same handles.
+	vector_copy(&dest->elems, &src->elems);
+	vector_copy(&dest->elem_slots, &src->elem_slots);
+	vector_copy(&dest->slots, &src->slots);
+	dest->first_free_slot = src->first_free_slot;
+}
@@ -0,0 +1,34 @@
+// Densely stored elements with stable handles (a "slot map").
+// Elements are kept contiguous, so iterating over them is as fast as over a Vector. Removing one moves the last element into its place instead of shifting everything after it. Handles stay valid until their element is removed, after which they're detected as stale (thanks to generation counters) even if their slot has been reused.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "vector.h"
+
+typedef uint32_t SlotHandle; // Generation in the upper bits, slot index in the lower ones.
+
+enum { SLOT_HANDLE_NONE = 0 }; // Never returned by slot_map_insert.
+
+typedef struct SlotMap {
+	Vector elems; // Dense array of elements.
+	Vector elem_slots; // Array of uint32_t: slot index of each element.
+	Vector slots; // Array of SlotMapSlot (see slotmap.c).
+	uint32_t first_free_slot;
+} SlotMap;
+
+void slot_map_init(SlotMap *map, size_t elem_size);
+
+size_t slot_map_size(SlotMap *map);
+
+void *slot_map_at(SlotMap *map, size_t i_elem);
+
+SlotHandle slot_map_handle_at(SlotMap *map, size_t i_elem);
+
+void *slot_map_get(SlotMap *map, SlotHandle handle);
+
+SlotHandle slot_map_insert(SlotMap *map, const void *elem);
+
+size_t slot_map_remove(SlotMap *map, SlotHandle handle);
+
+void slot_map_copy(SlotMap *dest, SlotMap *src);
@@ -0,0 +1,299 @@
+#include "snapshot.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "serialization.h"
+#include "vector.h"
+
+void snapshot_init(Snapshot *snapshot) {
+	snapshot->sequence_num = 0;
+	vector_init(&snapshot->players, sizeof(SPlayer));
+	vector_init(&snapshot->explosions, sizeof(SExplosion));
+	vector_init(&snapshot->projectiles, sizeof(SProjectile));
+}
+
+void snapshot_clear(Snapshot *snapshot, SSequenceNum sequence_num) {
+	snapshot->sequence_num = sequence_num;
+	vector_resize(&snapshot->players, 0);
+	vector_resize(&snapshot->explosions, 0);
+	vector_resize(&snapshot->projectiles, 0);
+}
+
+
+/// Sorting and diffing by ID.
+
+typedef SEntityId (*IdGetter)(const void *elem);
+
+static SEntityId player_id(const void *elem) {
+	return ((const SPlayer *) elem)->id;
+}
+
+static SEntityId explosion_id(const void *elem) {
+	return ((const SExplosion *) elem)->id;
+}
+
+static SEntityId projectile_id(const void *elem) {
+	return ((const SProjectile *) elem)->id;
+}
+
+static int compare_players(const void *a, const void *b) {
+	SEntityId id_a = player_id(a);
+	SEntityId id_b = player_id(b);
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static int compare_explosions(const void *a, const void *b) {
+	SEntityId id_a = explosion_id(a);
+	SEntityId id_b = explosion_id(b);
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static int compare_projectiles(const void *a, const void *b) {
+	SEntityId id_a = projectile_id(a);
+	SEntityId id_b = projectile_id(b);
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static void sort_by_id(Vector *elems, IdGetter id_of,
+                       int (*compare)(const void *, const void *)) {
+	// Entities are usually created in ID order, so only sort if necessary.
+	for (size_t i_elem = 1; i_elem < elems->n_elems; i_elem++) {
+		if (id_of(vector_get(elems, i_elem - 1))
+		    > id_of(vector_get(elems, i_elem))) {
+			qsort(elems->array, elems->n_elems, elems->elem_size, compare);
+			return;
+		}
+	}
+}
+
+void snapshot_sort(Snapshot *snapshot) {
+	sort_by_id(&snapshot->players, player_id, compare_players);
+	sort_by_id(&snapshot->explosions, explosion_id, compare_explosions);
+	sort_by_id(&snapshot->projectiles, projectile_id, compare_projectiles);
+}
+
+static void diff_by_id(Vector *current, Vector *baseline, IdGetter id_of,
+                       bool include_changed, Vector *added,
+                       Vector *removed_ids) {
+	// Both arrays must be sorted by ID. Push elements of current that aren't in baseline (or, if include_changed, differ from their baseline version) onto added, and IDs (as SEntityId) of elements of baseline that aren't in current onto removed_ids. baseline may be NULL.
+
+	vector_resize(added, 0);
+	vector_resize(removed_ids, 0);
+
+	size_t n_baseline = (baseline == NULL) ? 0 : baseline->n_elems;
+	size_t i_curr = 0;
+	size_t i_base = 0;
+	while (i_curr < current->n_elems || i_base < n_baseline) {
+		void *curr = (i_curr < current->n_elems)
+			? vector_get(current, i_curr) : NULL;
+		void *base = (i_base < n_baseline)
+			? vector_get(baseline, i_base) : NULL;
+
+		if (base == NULL || (curr != NULL && id_of(curr) < id_of(base))) {
+			vector_push(added, curr);
+			i_curr++;
+		} else if (curr == NULL || id_of(base) < id_of(curr)) {
+			SEntityId id = id_of(base);
+			vector_push(removed_ids, &id);
+			i_base++;
+		} else {
+			if (include_changed
+			    && memcmp(curr, base, current->elem_size) != 0)
+				vector_push(added, curr);
+			i_curr++;
+			i_base++;
+		}
+	}
+}
+
+
+/// Encoding.
+
+static char *write_array(void *array, char *packet_end, Vector *elems,
+                         size_t i_first, size_t n_elems) {
+	// Write n_elems elements of elems starting at i_first.
+	s_array_init(array, packet_end, n_elems);
+	size_t size = n_elems * elems->elem_size;
+	memcpy(packet_end, vector_get(elems, i_first), size);
+	return packet_end + size;
+}
+
+void snapshot_encode(Snapshot *snapshot, Snapshot *baseline,
+                     const SGameSettings *game_settings,
+                     size_t max_chunk_size, Vector *packet,
+                     Vector *chunk_ends) {
+	// Serialize a simulation tick into packet (a vector of bytes), delta-compressed against baseline (NULL for a full snapshot) and split into chunks of at most max_chunk_size bytes, stored back to back. chunk_ends (an array of size_t) receives the offset in packet just after each chunk. The per-recipient fields are left zeroed (see snapshot_patch_recipient).
+
+	assert(packet->elem_size == 1);
+	assert(chunk_ends->elem_size == sizeof(size_t));
+	assert(baseline == NULL
+	       || (baseline->sequence_num < snapshot->sequence_num
+	           && snapshot->sequence_num - baseline->sequence_num
+	              <= UINT8_MAX));
+	assert(max_chunk_size >= SNAPSHOT_PACKET_PREFIX_SIZE + sizeof(SPlayer)); // The biggest element.
+
+	// Scratch space for the diffs (per thread, since arenas are encoded in parallel).
+	static _Thread_local bool scratch_initialized = false;
+	static _Thread_local Vector players, removed_player_ids;
+	static _Thread_local Vector explosions, removed_explosion_ids;
+	static _Thread_local Vector projectiles, removed_projectile_ids;
+	static _Thread_local Vector removed_ids;
+	if (!scratch_initialized) {
+		vector_init(&players, sizeof(SPlayer));
+		vector_init(&removed_player_ids, sizeof(SPlayerId));
+		vector_init(&explosions, sizeof(SExplosion));
+		vector_init(&removed_explosion_ids, sizeof(SEntityId));
+		vector_init(&projectiles, sizeof(SProjectile));
+		vector_init(&removed_projectile_ids, sizeof(SEntityId));
+		vector_init(&removed_ids, sizeof(SEntityId));
+		scratch_initialized = true;
+	}
+
+	// Players can change in any way, explosions and projectiles only in ways that the client can predict.
+	diff_by_id(&snapshot->players,
+	           (baseline == NULL) ? NULL : &baseline->players,
+	           player_id, true, &players, &removed_ids);
+	vector_resize(&removed_player_ids, removed_ids.n_elems);
+	for (size_t i_id = 0; i_id < removed_ids.n_elems; i_id++) {
+		SPlayerId id = *(SEntityId *) vector_get(&removed_ids, i_id);
+		vector_set(&removed_player_ids, i_id, &id);
+	}
+	diff_by_id(&snapshot->explosions,
+	           (baseline == NULL) ? NULL : &baseline->explosions,
+	           explosion_id, false, &explosions, &removed_explosion_ids);
+	diff_by_id(&snapshot->projectiles,
+	           (baseline == NULL) ? NULL : &baseline->projectiles,
+	           projectile_id, false, &projectiles, &removed_projectile_ids);
+
+	// Every chunk gets as many of the remaining elements as fit, taken from the arrays in order.
+	enum { N_ARRAYS = 6 };
+	Vector *arrays[N_ARRAYS] = {
+		&players, &removed_player_ids, &explosions, &removed_explosion_ids,
+		&projectiles, &removed_projectile_ids,
+	};
+	static const size_t array_offsets[N_ARRAYS] = {
+		offsetof(SSimulationTickPacket, players),
+		offsetof(SSimulationTickPacket, removed_player_ids),
+		offsetof(SSimulationTickPacket, explosions),
+		offsetof(SSimulationTickPacket, removed_explosion_ids),
+		offsetof(SSimulationTickPacket, projectiles),
+		offsetof(SSimulationTickPacket, removed_projectile_ids),
+	};
+	size_t i_next_elems[N_ARRAYS] = {0};
+
+	vector_resize(packet, 0);
+	vector_resize(chunk_ends, 0);
+	bool all_written;
+	do {
+		size_t n_chunk_elems[N_ARRAYS];
+		size_t chunk_size = SNAPSHOT_PACKET_PREFIX_SIZE;
+		for (int i_array = 0; i_array < N_ARRAYS; i_array++) {
+			Vector *elems = arrays[i_array];
+			size_t n_fitting = (max_chunk_size - chunk_size) / elems->elem_size;
+			size_t n_left = elems->n_elems - i_next_elems[i_array];
+			n_chunk_elems[i_array] = (n_left < n_fitting) ? n_left : n_fitting;
+			chunk_size += n_chunk_elems[i_array] * elems->elem_size;
+		}
+
+		size_t chunk_begin = packet->n_elems;
+		vector_resize(packet, chunk_begin + chunk_size);
+		char *packet_end = (char *) packet->array + chunk_begin; // char* instead of void* to simplify pointer arithmetic.
+
+		// Header.
+		SPacketHeader *header = (SPacketHeader *) packet_end;
+		packet_end += sizeof(*header);
+		s_packet_header_init(header, S_PT_SIMULATION_TICK);
+
+		// Game settings and other non-array data.
+		SSimulationTickPacket *tick_packet =
+			(SSimulationTickPacket *) packet_end;
+		packet_end += sizeof(*tick_packet);
+		tick_packet->sequence_num = snapshot->sequence_num;
+		tick_packet->baseline_age = (baseline == NULL)
+			? 0 : snapshot->sequence_num - baseline->sequence_num;
+		tick_packet->chunk_index = chunk_ends->n_elems;
+		tick_packet->n_chunks = 0; // Filled in below.
+		tick_packet->ack_input_sequence_num = 0;
+		tick_packet->your_player_id = 0;
+		tick_packet->game_settings = *game_settings;
+
+		// Arrays.
+		all_written = true;
+		for (int i_array = 0; i_array < N_ARRAYS; i_array++) {
+			packet_end = write_array(
+				(char *) tick_packet + array_offsets[i_array], packet_end,
+				arrays[i_array], i_next_elems[i_array],
+				n_chunk_elems[i_array]);
+			i_next_elems[i_array] += n_chunk_elems[i_array];
+			if (i_next_elems[i_array] < arrays[i_array]->n_elems)
+				all_written = false;
+		}
+
+		assert(packet_end == (char *) packet->array + packet->n_elems);
+		vector_push(chunk_ends, &packet->n_elems);
+	} while (!all_written);
+
+	assert(chunk_ends->n_elems <= UINT16_MAX);
+	uint16_t n_chunks = chunk_ends->n_elems;
+	size_t chunk_begin = 0;
+	for (size_t i_chunk = 0; i_chunk < chunk_ends->n_elems; i_chunk++) {
+		memcpy((char *) packet->array + chunk_begin + sizeof(SPacketHeader)
+		       + offsetof(SSimulationTickPacket, n_chunks),
+		       &n_chunks, sizeof(n_chunks));
+		chunk_begin = *(size_t *) vector_get(chunk_ends, i_chunk);
+	}
+}
+
+void snapshot_patch_recipient(void *packet, SPlayerId your_player_id,
+                              SSequenceNum ack_input_sequence_num) {
+	// Fill in the per-recipient fields of an encoded packet. Only the first SNAPSHOT_PACKET_PREFIX_SIZE bytes are touched, and since arrays use relative pointers, they may be a copy of the packet's prefix.
+
+	char *tick_packet = (char *) packet + sizeof(SPacketHeader);
+	memcpy(tick_packet
+	       + offsetof(SSimulationTickPacket, ack_input_sequence_num),
+	       &ack_input_sequence_num, sizeof(ack_input_sequence_num));
+	memcpy(tick_packet + offsetof(SSimulationTickPacket, your_player_id),
+	       &your_player_id, sizeof(your_player_id));
+}
+
+
+/// Recent snapshots.
+
+void snapshot_history_init(SnapshotHistory *history) {
+	for (int i = 0; i < SNAPSHOT_HISTORY_LEN; i++)
+		snapshot_init(&history->snapshots[i]);
+}
+
+Snapshot *snapshot_history_add(SnapshotHistory *history,
+                               SSequenceNum sequence_num) {
+	// Return value: an empty snapshot with the given sequence number, which replaces the oldest one in the history.
+	assert(sequence_num != 0);
+	Snapshot *snapshot =
+		&history->snapshots[sequence_num % SNAPSHOT_HISTORY_LEN];
+	snapshot_clear(snapshot, sequence_num);
+	return snapshot;
+}
+
+Snapshot *snapshot_history_get(SnapshotHistory *history,
+                               SSequenceNum sequence_num) {
+	// Return value: the snapshot with the given sequence number, NULL if it's no longer (or not yet) in the history.
+	if (sequence_num == 0)
+		return NULL;
+	Snapshot *snapshot =
+		&history->snapshots[sequence_num % SNAPSHOT_HISTORY_LEN];
+	return (snapshot->sequence_num == sequence_num) ? snapshot : NULL;
+}
+
+Snapshot *snapshot_history_baseline(SnapshotHistory *history,
+                                    Snapshot *snapshot,
+                                    SSequenceNum sequence_num) {
+	// Return value: the snapshot with the given sequence number if snapshot can be delta-compressed against it, NULL if it's missing, not older than snapshot or too old for baseline_age. (Captures may be skipped under overload, so a slot of the history can keep a snapshot far older than SNAPSHOT_HISTORY_LEN ticks.)
+	Snapshot *baseline = snapshot_history_get(history, sequence_num);
+	if (baseline == NULL || baseline->sequence_num >= snapshot->sequence_num
+	    || snapshot->sequence_num - baseline->sequence_num > UINT8_MAX)
+		return NULL;
+	return baseline;
+}
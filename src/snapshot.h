@@ -0,0 +1,52 @@
+// World snapshots and delta-compressed simulation tick packets.
+
+#pragma once
+#include <stddef.h>
+#include "serialization.h"
+#include "vector.h"
+
+typedef struct Snapshot {
+	SSequenceNum sequence_num; // 0 if the snapshot is unused.
+	Vector players; // Array of SPlayer, sorted by id.
+	Vector explosions; // Array of SExplosion, sorted by id.
+	Vector projectiles; // Array of SProjectile, sorted by id.
+} Snapshot;
+
+void snapshot_init(Snapshot *snapshot);
+
+void snapshot_clear(Snapshot *snapshot, SSequenceNum sequence_num);
+
+void snapshot_sort(Snapshot *snapshot);
+
+// Part of every encoded chunk that differs between recipients (see snapshot_patch_recipient). Everything after it can be shared.
+enum { SNAPSHOT_PACKET_PREFIX_SIZE =
+	sizeof(SPacketHeader) + sizeof(SSimulationTickPacket) };
+
+void snapshot_encode(Snapshot *snapshot, Snapshot *baseline,
+                     const SGameSettings *game_settings,
+                     size_t max_chunk_size, Vector *packet,
+                     Vector *chunk_ends);
+
+void snapshot_patch_recipient(void *packet, SPlayerId your_player_id,
+                              SSequenceNum ack_input_sequence_num);
+
+
+/// Recent snapshots, used as baselines for delta compression.
+
+enum { SNAPSHOT_HISTORY_LEN = 32 };
+
+typedef struct SnapshotHistory {
+	Snapshot snapshots[SNAPSHOT_HISTORY_LEN];
+} SnapshotHistory;
+
+void snapshot_history_init(SnapshotHistory *history);
+
+Snapshot *snapshot_history_add(SnapshotHistory *history,
+                               SSequenceNum sequence_num);
+
+Snapshot *snapshot_history_get(SnapshotHistory *history,
+                               SSequenceNum sequence_num);
+
+Snapshot *snapshot_history_baseline(SnapshotHistory *history,
+                                    Snapshot *snapshot,
+                                    SSequenceNum sequence_num);
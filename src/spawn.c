@@ -0,0 +1,164 @@
+#include "spawn.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include "grid.h"
+#include "serialization.h"
+#include "vec2f.h"
+#include "vector.h"
+
+void spawn_finder_init(SpawnFinder *finder, SVectorInt level_size,
+                       float step) {
+	assert(step > 0);
+	finder->step = step;
+	vector_init(&finder->threats, sizeof(Vec2f));
+	// Cells of two steps keep the rings around a point small, without making the grid big.
+	grid_init(&finder->grid, level_size, step * 2);
+}
+
+void spawn_finder_clear(SpawnFinder *finder) {
+	vector_resize(&finder->threats, 0);
+}
+
+void spawn_finder_add_threat(SpawnFinder *finder, Vec2f position) {
+	vector_push(&finder->threats, &position);
+}
+
+
+/// Lattice.
+
+static Vec2f lattice_first(SpawnFinder *finder) {
+	Vec2f point = { finder->step, finder->step };
+	return point;
+}
+
+static bool lattice_next(SpawnFinder *finder, Vec2f *point) {
+	// Move to the next point, row by row. Return value: false if there are no more.
+	SVectorInt level_size = finder->grid.level_size;
+	point->x += finder->step;
+	if (level_size.x - point->x <= finder->step) {
+		point->x = finder->step;
+		point->y += finder->step;
+	}
+	return level_size.y - point->y > finder->step;
+}
+
+static float edge_distance(SpawnFinder *finder, Vec2f point) {
+	SVectorInt level_size = finder->grid.level_size;
+	return fminf(fminf(point.x, level_size.x - point.x),
+	             fminf(point.y, level_size.y - point.y));
+}
+
+
+/// Search.
+
+static bool scan_cell(SpawnFinder *finder, Vec2f point, int column, int row,
+                      float best_distance, float *distance) {
+	// Lower distance to the nearest threat in a cell. Return value: false if it fell to best_distance or below (so there's no point in looking further).
+
+	Grid *grid = &finder->grid;
+	if (column < 0 || column >= grid->n_columns
+	    || row < 0 || row >= grid->n_rows)
+		return true;
+
+	size_t n_items;
+	const uint32_t *items =
+		grid_cell_items(grid, row * grid->n_columns + column, &n_items);
+	for (size_t i_item = 0; i_item < n_items; i_item++) {
+		Vec2f *threat = vector_get(&finder->threats, items[i_item]);
+		*distance = fminf(*distance, vec2f_distance(point, *threat));
+		if (*distance <= best_distance)
+			return false;
+	}
+	return true;
+}
+
+static bool scan_ring(SpawnFinder *finder, Vec2f point, int column, int row,
+                      int ring, float best_distance, float *distance) {
+	// Like scan_cell, for the cells that are ring cells away from (column, row) horizontally or vertically (whichever is more).
+
+	if (ring == 0)
+		return scan_cell(finder, point, column, row, best_distance, distance);
+
+	for (int i = -ring; i <= ring; i++) {
+		if (!scan_cell(finder, point, column + i, row - ring,
+		               best_distance, distance)
+		    || !scan_cell(finder, point, column + i, row + ring,
+		                  best_distance, distance))
+			return false;
+	}
+	for (int i = -ring + 1; i <= ring - 1; i++) {
+		if (!scan_cell(finder, point, column - ring, row + i,
+		               best_distance, distance)
+		    || !scan_cell(finder, point, column + ring, row + i,
+		                  best_distance, distance))
+			return false;
+	}
+	return true;
+}
+
+Vec2f spawn_finder_find(SpawnFinder *finder) {
+	// Return value: the lattice point farthest from the edges and threats (the first one, if several are equally far).
+
+	Grid *grid = &finder->grid;
+	grid_clear(grid);
+	for (size_t i_threat = 0; i_threat < finder->threats.n_elems; i_threat++)
+		grid_insert(grid, i_threat, *(Vec2f *)
+		            vector_get(&finder->threats, i_threat));
+	grid_finish(grid);
+
+	// Anything ring cells away from a point's cell is at least (ring - 1) * ring_spacing from it. The level doesn't wrap here: the distances are measured within it, like the ones from the edges.
+	float ring_spacing = fminf(grid->cell_width, grid->cell_height);
+	int max_ring = (grid->n_columns > grid->n_rows)
+		? grid->n_columns : grid->n_rows;
+
+	Vec2f point = lattice_first(finder);
+	Vec2f best_position = point;
+	float best_distance = 0;
+	do {
+		// Only threats nearer than the edges matter. Stop once the point can't win, or once the rings are too far away to hold anything nearer (with some slack for rounding errors).
+		float distance = edge_distance(finder, point);
+		if (distance <= best_distance)
+			continue;
+		int column = (int) floor(point.x / grid->cell_width);
+		int row = (int) floor(point.y / grid->cell_height);
+		bool can_win = true;
+		for (int ring = 0; can_win && ring <= max_ring
+		     && (ring - 1) * ring_spacing - 0.01f < distance; ring++) {
+			can_win = scan_ring(finder, point, column, row, ring,
+			                    best_distance, &distance);
+		}
+
+		if (can_win) {
+			best_position = point;
+			best_distance = distance;
+		}
+	} while (lattice_next(finder, &point));
+
+	return best_position;
+}
+
+Vec2f spawn_finder_find_brute_force(SpawnFinder *finder) {
+	// Measure the distance from every lattice point to every threat. Reference implementation for spawn_finder_find.
+
+	Vec2f point = lattice_first(finder);
+	Vec2f best_position = point;
+	float best_distance = 0;
+	do {
+		float distance = edge_distance(finder, point);
+		for (size_t i_threat = 0; i_threat < finder->threats.n_elems;
+		     i_threat++) {
+			distance = fminf(distance, vec2f_distance(
+				point, *(Vec2f *) vector_get(&finder->threats, i_threat)));
+		}
+
+		if (distance > best_distance) {
+			best_position = point;
+			best_distance = distance;
+		}
+	} while (lattice_next(finder, &point));
+
+	return best_position;
+}
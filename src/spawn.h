@@ -0,0 +1,25 @@
+// Choosing where players spawn: the point of a lattice over the level that is farthest from the level's edges and from threats (players and projectiles).
+// Threats are bucketed in a grid, and each lattice point only looks at the cells around it, nearest first, until it's clear that the point can't beat the best one so far. The result is the same as measuring the distance from every point to every threat (spawn_finder_find_brute_force), but it costs a small fraction of that.
+
+#pragma once
+#include "grid.h"
+#include "serialization.h"
+#include "vec2f.h"
+#include "vector.h"
+
+typedef struct SpawnFinder {
+	float step; // Between lattice points (and from the first ones to the edges).
+	Vector threats; // Of Vec2f.
+	Grid grid; // Indices into threats, built by spawn_finder_find.
+} SpawnFinder;
+
+void spawn_finder_init(SpawnFinder *finder, SVectorInt level_size,
+                       float step);
+
+void spawn_finder_clear(SpawnFinder *finder);
+
+void spawn_finder_add_threat(SpawnFinder *finder, Vec2f position);
+
+Vec2f spawn_finder_find(SpawnFinder *finder);
+
+Vec2f spawn_finder_find_brute_force(SpawnFinder *finder);
@@ -62,3 +62,14 @@ Vec2f vec2f_wrap_position(Vec2f position, SVectorInt limits) {
 
 	return position;
 }
+
+float vec2f_wrapped_distance_sqr(Vec2f a, Vec2f b, SVectorInt limits) {
+	// Squared distance in a toroidal world of the given size (going around the edges if that's shorter). Both positions should be wrapped.
+	float dx = fabsf(a.x - b.x);
+	if (dx > limits.x * 0.5f)
+		dx = limits.x - dx;
+	float dy = fabsf(a.y - b.y);
+	if (dy > limits.y * 0.5f)
+		dy = limits.y - dy;
+	return dx * dx + dy * dy;
+}
@@ -22,3 +22,5 @@ float vec2f_distance(Vec2f a, Vec2f b);
 Vec2f vec2f_velocity_add(Vec2f u, Vec2f v, float speed_limit);
 
 Vec2f vec2f_wrap_position(Vec2f position, SVectorInt limits);
+
+float vec2f_wrapped_distance_sqr(Vec2f a, Vec2f b, SVectorInt limits);
@@ -21,6 +21,14 @@ void vector_init(Vector *vector, size_t elem_size) {
 	vector_allocate(vector, VECTOR_INITIAL_N_ALLOCATED);
 }
 
+void vector_free(Vector *vector) {
+	// Release the vector's memory. It has to be initialized again before it's used.
+	free(vector->array);
+	vector->array = NULL;
+	vector->n_elems = 0;
+	vector->n_allocated = 0;
+}
+
 void vector_ensure_allocated(Vector *vector, size_t n_elems) {
 	if (vector->n_allocated < n_elems) {
 		size_t stretched_n_elems = vector->n_allocated * VECTOR_STRETCH_FACTOR;
@@ -83,3 +91,10 @@ void vector_delete(Vector *vector, size_t i_elem) {
 
 	vector_resize(vector, vector->n_elems - 1);
 }
+
+void vector_copy(Vector *dest, const Vector *src) {
+	// Make dest (an initialized vector) a copy of src.
+	assert(dest->elem_size == src->elem_size);
+	vector_resize(dest, src->n_elems);
+	memcpy(dest->array, src->array, src->n_elems * src->elem_size);
+}
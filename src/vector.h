@@ -14,6 +14,8 @@ void vector_allocate(Vector *vector, size_t n_allocated);
 
 void vector_init(Vector *vector, size_t elem_size);
 
+void vector_free(Vector *vector);
+
 void vector_ensure_allocated(Vector *vector, size_t n_elems);
 
 void vector_resize(Vector *vector, size_t n_elems);
@@ -31,3 +33,5 @@ void vector_pop(Vector *vector);
 void vector_insert(Vector *vector, size_t i_new_elem, const void *new_elem);
 
 void vector_delete(Vector *vector, size_t i_elem);
+
+void vector_copy(Vector *dest, const Vector *src);
@@ -0,0 +1,104 @@
+#include "workpool.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+#include "cpthread.h"
+
+static void work_pool_work(WorkPool *pool, WorkPoolFunction function,
+                           void *context, size_t n_items) {
+	// Items are handed out one at a time, so a slow item doesn't hold up the ones after it.
+	while (true) {
+		size_t i_item = atomic_fetch_add(&pool->next_item, 1);
+		if (i_item >= n_items)
+			break;
+		function(context, i_item);
+	}
+}
+
+static void work_pool_thread(void *arg) {
+	WorkPool *pool = arg;
+
+	// Every worker takes part in every batch (work_pool_start waits for all of them), so start from the generation set by work_pool_init. Reading pool->generation instead would skip a batch started before this thread got to run, and work_pool_wait would wait for it forever.
+	unsigned long generation = 0;
+	cpthread_mutex_lock(&pool->mutex);
+	while (true) {
+		while (pool->generation == generation)
+			cpthread_cond_wait(&pool->work_available, &pool->mutex);
+		generation = pool->generation;
+		WorkPoolFunction function = pool->function;
+		void *context = pool->context;
+		size_t n_items = pool->n_items;
+		cpthread_mutex_unlock(&pool->mutex);
+
+		work_pool_work(pool, function, context, n_items);
+
+		cpthread_mutex_lock(&pool->mutex);
+		pool->n_busy_threads--;
+		if (pool->n_busy_threads == 0)
+			cpthread_cond_broadcast(&pool->work_done);
+	}
+}
+
+bool work_pool_init(WorkPool *pool, int n_threads) {
+	// Return value: false if the threads couldn't be started.
+
+	pool->n_threads = n_threads;
+	cpthread_mutex_init(&pool->mutex);
+	cpthread_cond_init(&pool->work_available);
+	cpthread_cond_init(&pool->work_done);
+	pool->generation = 0;
+	pool->function = NULL;
+	pool->context = NULL;
+	pool->n_items = 0;
+	atomic_init(&pool->next_item, 0);
+	pool->n_busy_threads = 0;
+
+	for (int i_thread = 0; i_thread < n_threads; i_thread++) {
+		Cpthread thread;
+		if (!cpthread_create(&thread, work_pool_thread, pool))
+			return false;
+	}
+	return true;
+}
+
+void work_pool_start(WorkPool *pool, WorkPoolFunction function,
+                     void *context, size_t n_items) {
+	// Start calling function(context, i) for every i in [0, n_items) on the pool's threads, in no particular order, and return immediately. Wait for the calls to finish with work_pool_wait before starting more work. Without threads, everything runs before this returns.
+
+	if (pool->n_threads == 0) {
+		for (size_t i_item = 0; i_item < n_items; i_item++)
+			function(context, i_item);
+		return;
+	}
+
+	cpthread_mutex_lock(&pool->mutex);
+	assert(pool->n_busy_threads == 0);
+	pool->function = function;
+	pool->context = context;
+	pool->n_items = n_items;
+	atomic_store(&pool->next_item, 0);
+	pool->n_busy_threads = pool->n_threads;
+	pool->generation++;
+	cpthread_cond_broadcast(&pool->work_available);
+	cpthread_mutex_unlock(&pool->mutex);
+}
+
+void work_pool_wait(WorkPool *pool) {
+	// Wait until the work started by work_pool_start is done (returns immediately if there isn't any).
+	if (pool->n_threads == 0)
+		return;
+	cpthread_mutex_lock(&pool->mutex);
+	while (pool->n_busy_threads > 0)
+		cpthread_cond_wait(&pool->work_done, &pool->mutex);
+	cpthread_mutex_unlock(&pool->mutex);
+}
+
+void work_pool_run(WorkPool *pool, WorkPoolFunction function,
+                   void *context, size_t n_items) {
+	// Like work_pool_start followed by work_pool_wait, but the calling thread helps with the work.
+	work_pool_start(pool, function, context, n_items);
+	if (pool->n_threads > 0)
+		work_pool_work(pool, function, context, n_items);
+	work_pool_wait(pool);
+}
@@ -0,0 +1,35 @@
+// Pool of worker threads that run a function over a range of items in parallel.
+// work_pool_run has the calling thread work on the items too and returns once all of them are done, while work_pool_start leaves them to the pool so that the caller can do something else in the meantime. A pool with 0 threads simply runs everything on the caller.
+
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpthread.h"
+
+typedef void (*WorkPoolFunction)(void *context, size_t i_item);
+
+typedef struct WorkPool {
+	int n_threads;
+	CpthreadMutex mutex;
+	CpthreadCond work_available;
+	CpthreadCond work_done;
+
+	// Current batch of work (protected by mutex, except next_item).
+	unsigned long generation; // Incremented for every batch.
+	WorkPoolFunction function;
+	void *context;
+	size_t n_items;
+	atomic_size_t next_item;
+	int n_busy_threads;
+} WorkPool;
+
+bool work_pool_init(WorkPool *pool, int n_threads);
+
+void work_pool_start(WorkPool *pool, WorkPoolFunction function,
+                     void *context, size_t n_items);
+
+void work_pool_wait(WorkPool *pool);
+
+void work_pool_run(WorkPool *pool, WorkPoolFunction function,
+                   void *context, size_t n_items);
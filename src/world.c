@@ -0,0 +1,608 @@
+#include "world.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "color.h"
+#include "cptime.h"
+#include "grid.h"
+#include "kinematics.h"
+#include "ring.h"
+#include "serialization.h"
+#include "slotmap.h"
+#include "snapshot.h"
+#include "spawn.h"
+#include "vec2f.h"
+#include "vector.h"
+
+#if !defined(M_PI)
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+// Sizes (in pixels).
+const SVectorInt LEVEL_SIZE = {800, 600};
+static const float PLAYER_RADIUS = 30;
+const float SPAWN_STEP = 20;
+
+// Speeds and accelerations (in pixels / tick and pixels / tick^2).
+static const float PLAYER_ACCELERATION = 150.0 / (FPS * FPS);
+static const float PLAYER_BRAKING = -75.0 / (FPS * FPS);
+static const float PLAYER_TURN_RATE = M_PI / FPS;
+static const float SPEED_LIMIT = 500.0 / FPS;
+static const float PROJECTILE_SPEED = 500.0 / FPS;
+
+// Delays (in ticks).
+static const int SHOT_COOLDOWN = 0.5 * FPS;
+const int PROJECTILE_LIFETIME = 1.5 * FPS;
+static const int EXPLOSION_LIFETIME = 5 * FPS;
+static const int PLAYER_RESPAWN_DELAY = 1 * FPS;
+
+void world_init(World *world) {
+	slot_map_init(&world->players, sizeof(Player));
+	ring_init(&world->explosions, sizeof(Explosion));
+	ring_init(&world->projectile_expiry, sizeof(SlotHandle));
+	slot_map_init(&world->projectiles, sizeof(Projectile));
+	kinematics_init(&world->projectile_motion);
+	world->curr_tick = 0;
+	world->next_player_id = 0;
+	world->next_entity_id = 0;
+	spawn_finder_init(&world->spawn_finder, LEVEL_SIZE, SPAWN_STEP);
+	grid_init(&world->player_grid, LEVEL_SIZE, PLAYER_RADIUS * 2);
+	grid_init(&world->projectile_grid, LEVEL_SIZE, PLAYER_RADIUS * 2);
+}
+
+
+/// Math utilities.
+
+static float normalize_angle(float angle) {
+	// Normalize an angle in radians to [0, 2 * M_PI).
+	float result = fmod(angle, 2 * M_PI);
+	if (result < 0)
+		result += 2 * M_PI;
+	return result;
+}
+
+
+/// Physics and other game logic.
+
+Vec2f world_spawn_position(World *world) {
+	// Return a position that is approximately the farthest away from screen edges and collidable objects.
+
+	SpawnFinder *finder = &world->spawn_finder;
+	spawn_finder_clear(finder);
+	for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+	     i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+		if (player->alive)
+			spawn_finder_add_threat(finder, player->position);
+	}
+	for (size_t i_projectile = 0;
+	     i_projectile < slot_map_size(&world->projectiles);
+	     i_projectile++) {
+		spawn_finder_add_threat(finder, kinematics_position(
+			&world->projectile_motion, i_projectile));
+	}
+
+	Vec2f position = spawn_finder_find(finder);
+#if defined(VERIFY_SPAWN)
+	Vec2f position_brute = spawn_finder_find_brute_force(finder);
+	if (position.x != position_brute.x || position.y != position_brute.y) {
+		fprintf(stderr, "ERROR: Spawn position search disagrees with"
+		        " brute force in tick %d.\n", world->curr_tick);
+		abort();
+	}
+#endif
+	return position;
+}
+
+static void player_spawn(World *world, Player *player) {
+	player->alive = true;
+
+	player->heading = M_PI / 2;
+	player->velocity.x = 0;
+	player->velocity.y = 0;
+	player->position = world_spawn_position(world);
+
+	player->last_shot_tick = world->curr_tick;
+}
+
+static Color next_player_color(World *world) {
+	for (int i_color = 0;; i_color++) {
+		Color color = color_distinct(i_color);
+
+		bool color_used = false;
+		for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+		     i_player++) {
+			Player *player = slot_map_at(&world->players, i_player);
+			if (color_equal(player->color, color)) {
+				color_used = true;
+				break;
+			}
+		}
+
+		if (!color_used)
+			return color;
+	}
+}
+
+Player *world_add_player(World *world) {
+	// Add a spawned player. Its network fields are left for the caller to fill in.
+
+	Player new_player;
+	memset(&new_player, 0, sizeof(new_player));
+	new_player.id = world->next_player_id++;
+	new_player.color = next_player_color(world);
+	player_spawn(world, &new_player);
+	SlotHandle handle = slot_map_insert(&world->players, &new_player);
+	Player *player = slot_map_get(&world->players, handle);
+	player->handle = handle;
+	return player;
+}
+
+void world_add_projectile(World *world, Vec2f position, float heading,
+                          SlotHandle shooter) {
+	Projectile projectile;
+	projectile.id = world->next_entity_id++;
+	projectile.shooter = shooter;
+	projectile.creation_tick = world->curr_tick;
+	projectile.heading = heading;
+	Vec2f velocity = vec2f_from_polar(heading, PROJECTILE_SPEED);
+
+	SlotHandle handle = slot_map_insert(&world->projectiles, &projectile);
+	kinematics_push(&world->projectile_motion, position, velocity);
+	ring_push(&world->projectile_expiry, &handle);
+}
+
+static void player_shoot(World *world, Player *player) {
+	player->last_shot_tick = world->curr_tick;
+
+	Vec2f position = vec2f_wrap_position(
+		vec2f_add(player->position,
+		          vec2f_from_polar(player->heading, PLAYER_RADIUS)),
+		LEVEL_SIZE);
+	world_add_projectile(world, position, player->heading, player->handle);
+}
+
+static void projectile_remove(World *world, SlotHandle handle) {
+	// Both the slot map and the kinematics move the last projectile into the place of the removed one.
+	size_t i_projectile = slot_map_remove(&world->projectiles, handle);
+	kinematics_remove(&world->projectile_motion, i_projectile);
+}
+
+static void player_die(World *world, Player *player) {
+	player->alive = false;
+	player->ticks_until_respawn = PLAYER_RESPAWN_DELAY;
+
+	Explosion new_explosion;
+	new_explosion.id = world->next_entity_id++;
+	new_explosion.position = player->position;
+	new_explosion.creation_tick = world->curr_tick;
+	ring_push(&world->explosions, &new_explosion);
+}
+
+static bool players_collide(Player *a, Player *b) {
+	return vec2f_wrapped_distance_sqr(a->position, b->position, LEVEL_SIZE)
+		< (PLAYER_RADIUS * 2) * (PLAYER_RADIUS * 2);
+}
+
+static bool projectile_hits(World *world, size_t i_projectile, Player *player) {
+	return vec2f_wrapped_distance_sqr(
+		kinematics_position(&world->projectile_motion, i_projectile),
+		player->position, LEVEL_SIZE)
+		< PLAYER_RADIUS * PLAYER_RADIUS;
+}
+
+static void projectile_score_hit(World *world, Projectile *projectile,
+                                 Player *player) {
+	Player *shooter = slot_map_get(&world->players, projectile->shooter);
+	if (shooter == player)
+		shooter->score--;
+	else if (shooter != NULL)
+		shooter->score++;
+}
+
+static int compare_indices(const void *a, const void *b) {
+	size_t index_a = *(const size_t *) a;
+	size_t index_b = *(const size_t *) b;
+	return (index_a > index_b) - (index_a < index_b);
+}
+
+void world_detect_collisions(World *world) {
+	// Only check pairs of objects in nearby grid cells. The results (including the order of created explosions) are the same as those of detect_collisions_brute_force.
+
+	static _Thread_local bool scratch_initialized = false;
+	static _Thread_local Vector cells; // Array of int.
+	static _Thread_local Vector colliding_players; // Array of size_t.
+	static _Thread_local Vector projectile_hit; // Array of bool.
+	static _Thread_local Vector hit_projectiles; // Array of SlotHandle.
+	if (!scratch_initialized) {
+		vector_init(&cells, sizeof(int));
+		vector_init(&colliding_players, sizeof(size_t));
+		vector_init(&projectile_hit, sizeof(bool));
+		vector_init(&hit_projectiles, sizeof(SlotHandle));
+		scratch_initialized = true;
+	}
+
+	grid_clear(&world->player_grid);
+	for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+	     i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+		if (player->alive)
+			grid_insert(&world->player_grid, i_player, player->position);
+	}
+	grid_finish(&world->player_grid);
+
+	grid_clear(&world->projectile_grid);
+	for (size_t i_projectile = 0;
+	     i_projectile < slot_map_size(&world->projectiles);
+	     i_projectile++) {
+		grid_insert(&world->projectile_grid, i_projectile,
+		            kinematics_position(&world->projectile_motion,
+		                                i_projectile));
+	}
+	grid_finish(&world->projectile_grid);
+
+	vector_resize(&projectile_hit, slot_map_size(&world->projectiles));
+	bool *hit = projectile_hit.array;
+	for (size_t i_projectile = 0;
+	     i_projectile < slot_map_size(&world->projectiles);
+	     i_projectile++)
+		hit[i_projectile] = false;
+
+	for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+	     i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+		if (!player->alive)
+			continue;
+
+		bool player_dies = false;
+
+		// Collisions with other players (processed in index order).
+		vector_resize(&colliding_players, 0);
+		grid_query_cells(&world->player_grid, player->position,
+		                 PLAYER_RADIUS * 2, &cells);
+		for (size_t i_cell = 0; i_cell < cells.n_elems; i_cell++) {
+			size_t n_items;
+			const uint32_t *items = grid_cell_items(
+				&world->player_grid, *(int *) vector_get(&cells, i_cell),
+				&n_items);
+			for (size_t i_item = 0; i_item < n_items; i_item++) {
+				size_t i_other = items[i_item];
+				Player *other = slot_map_at(&world->players, i_other);
+				if (i_other > i_player && other->alive
+				    && players_collide(player, other))
+					vector_push(&colliding_players, &i_other);
+			}
+		}
+		qsort(colliding_players.array, colliding_players.n_elems,
+		      sizeof(size_t), compare_indices);
+		for (size_t i_colliding = 0; i_colliding < colliding_players.n_elems;
+		     i_colliding++) {
+			size_t i_other =
+				*(size_t *) vector_get(&colliding_players, i_colliding);
+			player_dies = true;
+			player_die(world, slot_map_at(&world->players, i_other));
+		}
+
+		// Collisions with projectiles.
+		grid_query_cells(&world->projectile_grid, player->position,
+		                 PLAYER_RADIUS, &cells);
+		for (size_t i_cell = 0; i_cell < cells.n_elems; i_cell++) {
+			size_t n_items;
+			const uint32_t *items = grid_cell_items(
+				&world->projectile_grid, *(int *) vector_get(&cells, i_cell),
+				&n_items);
+			for (size_t i_item = 0; i_item < n_items; i_item++) {
+				size_t i_projectile = items[i_item];
+				Projectile *projectile =
+					slot_map_at(&world->projectiles, i_projectile);
+				if (!hit[i_projectile]
+				    && projectile_hits(world, i_projectile, player)) {
+					projectile_score_hit(world, projectile, player);
+					player_dies = true;
+					hit[i_projectile] = true;
+				}
+			}
+		}
+
+		if (player_dies)
+			player_die(world, player);
+	}
+
+	// Delete the projectiles that hit something. (Deleting renumbers projectiles, so first collect their handles.)
+	vector_resize(&hit_projectiles, 0);
+	for (size_t i_projectile = 0;
+	     i_projectile < slot_map_size(&world->projectiles);
+	     i_projectile++) {
+		if (hit[i_projectile]) {
+			SlotHandle handle =
+				slot_map_handle_at(&world->projectiles, i_projectile);
+			vector_push(&hit_projectiles, &handle);
+		}
+	}
+	for (size_t i_hit = 0; i_hit < hit_projectiles.n_elems; i_hit++)
+		projectile_remove(
+			world, *(SlotHandle *) vector_get(&hit_projectiles, i_hit));
+}
+
+#if defined(VERIFY_BROADPHASE)
+static void detect_collisions_brute_force(World *world) {
+	// Check every pair of objects. Reference implementation for detect_collisions.
+
+	for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+	     i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+		if (!player->alive)
+			continue;
+
+		bool player_dies = false;
+
+		// Collisions with other players.
+		for (size_t i_other = i_player + 1;
+		     i_other < slot_map_size(&world->players); i_other++) {
+			Player *other = slot_map_at(&world->players, i_other);
+			if (!other->alive)
+				continue;
+
+			if (players_collide(player, other)) {
+				player_dies = true;
+				player_die(world, other);
+			}
+		}
+
+		// Collisions with projectiles.
+		for (size_t i_projectile = 0;
+		     i_projectile < slot_map_size(&world->projectiles);) {
+			Projectile *projectile =
+				slot_map_at(&world->projectiles, i_projectile);
+
+			if (projectile_hits(world, i_projectile, player)) {
+				projectile_score_hit(world, projectile, player);
+				player_dies = true;
+				projectile_remove(world, 
+					slot_map_handle_at(&world->projectiles, i_projectile));
+			} else {
+				i_projectile++;
+			}
+		}
+
+		if (player_dies)
+			player_die(world, player);
+	}
+}
+
+static void verify_collisions(World *world) {
+	// Run both collision detection algorithms on the same world and abort if the results differ.
+
+	static _Thread_local bool copies_initialized = false;
+	static _Thread_local SlotMap players_before, projectiles_before;
+	static _Thread_local SlotMap players_brute, projectiles_brute;
+	static _Thread_local Kinematics projectile_motion_before;
+	static _Thread_local Kinematics projectile_motion_brute;
+	static _Thread_local Ring explosions_before, explosions_brute;
+	if (!copies_initialized) {
+		slot_map_init(&players_before, sizeof(Player));
+		slot_map_init(&projectiles_before, sizeof(Projectile));
+		ring_init(&explosions_before, sizeof(Explosion));
+		slot_map_init(&players_brute, sizeof(Player));
+		slot_map_init(&projectiles_brute, sizeof(Projectile));
+		kinematics_init(&projectile_motion_before);
+		kinematics_init(&projectile_motion_brute);
+		ring_init(&explosions_brute, sizeof(Explosion));
+		copies_initialized = true;
+	}
+
+	slot_map_copy(&players_before, &world->players);
+	slot_map_copy(&projectiles_before, &world->projectiles);
+	kinematics_copy(&projectile_motion_before, &world->projectile_motion);
+	ring_copy(&explosions_before, &world->explosions);
+	SEntityId next_entity_id_before = world->next_entity_id;
+
+	detect_collisions_brute_force(world);
+	slot_map_copy(&players_brute, &world->players);
+	slot_map_copy(&projectiles_brute, &world->projectiles);
+	kinematics_copy(&projectile_motion_brute, &world->projectile_motion);
+	ring_copy(&explosions_brute, &world->explosions);
+
+	slot_map_copy(&world->players, &players_before);
+	slot_map_copy(&world->projectiles, &projectiles_before);
+	kinematics_copy(&world->projectile_motion, &projectile_motion_before);
+	ring_copy(&world->explosions, &explosions_before);
+	world->next_entity_id = next_entity_id_before;
+
+	world_detect_collisions(world);
+
+	// Both versions only modify fields of the same objects in the same order, so comparing bytes (including padding) is fine. Projectiles are removed in a different order, so they're matched by handle.
+	size_t n_players = slot_map_size(&world->players);
+	size_t n_projectiles = slot_map_size(&world->projectiles);
+	bool same =
+		n_players == slot_map_size(&players_brute)
+		&& n_projectiles == slot_map_size(&projectiles_brute)
+		&& ring_size(&world->explosions) == ring_size(&explosions_brute)
+		&& memcmp(slot_map_at(&world->players, 0),
+		          slot_map_at(&players_brute, 0),
+		          n_players * sizeof(Player)) == 0;
+	for (size_t i_explosion = 0;
+	     same && i_explosion < ring_size(&world->explosions);
+	     i_explosion++) {
+		same = memcmp(ring_get(&world->explosions, i_explosion),
+		              ring_get(&explosions_brute, i_explosion),
+		              sizeof(Explosion)) == 0;
+	}
+	for (size_t i_projectile = 0; same && i_projectile < n_projectiles;
+	     i_projectile++) {
+		SlotHandle handle =
+			slot_map_handle_at(&world->projectiles, i_projectile);
+		Projectile *brute = slot_map_get(&projectiles_brute, handle);
+		if (brute == NULL) {
+			same = false;
+			break;
+		}
+		size_t i_brute =
+			brute - (Projectile *) slot_map_at(&projectiles_brute, 0);
+		Vec2f position =
+			kinematics_position(&world->projectile_motion, i_projectile);
+		Vec2f position_brute =
+			kinematics_position(&projectile_motion_brute, i_brute);
+		same = memcmp(slot_map_at(&world->projectiles, i_projectile), brute,
+		              sizeof(Projectile)) == 0
+			&& position.x == position_brute.x
+			&& position.y == position_brute.y;
+	}
+	if (!same) {
+		fprintf(stderr, "ERROR: Broadphase collision detection disagrees"
+		        " with brute force in tick %d.\n", world->curr_tick);
+		abort();
+	}
+}
+#endif
+
+void world_move(World *world) {
+	// Advance everything by a tick, except for collisions (see world_tick).
+
+	world->curr_tick++;
+
+	// Tick explosions (i.e. delete the ones whose lifetime has elapsed).
+	while (ring_size(&world->explosions) > 0) {
+		Explosion *explosion = ring_front(&world->explosions);
+		if (world->curr_tick - explosion->creation_tick <= EXPLOSION_LIFETIME)
+			break;
+		ring_pop(&world->explosions);
+	}
+
+	// Tick players.
+	for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+	     i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+
+		if (!player->alive) {
+			player->ticks_until_respawn--;
+			if (player->ticks_until_respawn <= 0)
+				player_spawn(world, player);
+			continue;
+		}
+
+		// Rotation.
+		switch (player->input.rotate) {
+		case S_PR_LEFT:
+			player->heading += PLAYER_TURN_RATE;
+			break;
+		case S_PR_RIGHT:
+			player->heading -= PLAYER_TURN_RATE;
+			break;
+		default:
+			break;
+		}
+		player->heading = normalize_angle(player->heading);
+
+		// Acceleration.
+		float acceleration;
+		switch (player->input.accelerate) {
+		case S_PA_FORWARD:
+			acceleration = PLAYER_ACCELERATION;
+			break;
+		case S_PA_REVERSE:
+			acceleration = PLAYER_BRAKING;
+			break;
+		default:
+			acceleration = 0;
+			break;
+		}
+		player->velocity = vec2f_velocity_add(
+			player->velocity,
+			vec2f_from_polar(player->heading, acceleration),
+			SPEED_LIMIT);
+
+		// Position.
+		player->position = vec2f_wrap_position(
+			vec2f_add(player->position, player->velocity), LEVEL_SIZE);
+
+		// Shooting.
+		if (player->input.shoot
+		    && world->curr_tick >= player->last_shot_tick + SHOT_COOLDOWN) {
+			player_shoot(world, player);
+		}
+	}
+
+	// Tick projectiles.
+	kinematics_integrate(&world->projectile_motion, LEVEL_SIZE);
+
+	// Delete projectiles whose lifetime has elapsed. They all have the same lifetime, so they expire in order of creation. (Handles of projectiles that have hit something are stale.)
+	while (ring_size(&world->projectile_expiry) > 0) {
+		SlotHandle handle =
+			*(SlotHandle *) ring_front(&world->projectile_expiry);
+		Projectile *projectile = slot_map_get(&world->projectiles, handle);
+		if (projectile != NULL) {
+			if (world->curr_tick - projectile->creation_tick
+			    <= PROJECTILE_LIFETIME)
+				break;
+			projectile_remove(world, handle);
+		}
+		ring_pop(&world->projectile_expiry);
+	}
+}
+
+void world_tick(World *world) {
+	world_move(world);
+#if defined(VERIFY_BROADPHASE)
+	verify_collisions(world);
+#else
+	world_detect_collisions(world);
+#endif
+}
+
+void world_capture(World *world, Snapshot *snapshot) {
+	// Record the state of the world in an empty snapshot.
+
+	for (size_t i_player = 0; i_player < slot_map_size(&world->players);
+	     i_player++) {
+		Player *player = slot_map_at(&world->players, i_player);
+		SPlayer s_player;
+		memset(&s_player, 0, sizeof(s_player)); // Snapshots are compared with memcmp.
+		s_player.id = player->id;
+		s_player.position = s_position_encode(player->position, LEVEL_SIZE);
+		s_player.heading_and_flags =
+			s_heading_encode(player->heading, S_PLAYER_HEADING_BITS);
+		if (player->alive)
+			s_player.heading_and_flags |= S_PLAYER_ALIVE;
+		s_player.score = player->score;
+		s_player.color.red = player->color.red;
+		s_player.color.green = player->color.green;
+		s_player.color.blue = player->color.blue;
+		vector_push(&snapshot->players, &s_player);
+	}
+
+	for (size_t i_expl = 0; i_expl < ring_size(&world->explosions); i_expl++) {
+		Explosion *explosion = ring_get(&world->explosions, i_expl);
+		SExplosion s_explosion;
+		s_explosion.id = explosion->id;
+		s_explosion.position =
+			s_position_encode(explosion->position, LEVEL_SIZE);
+		s_explosion.n_ticks_since_creation =
+			s_tick_age_encode(world->curr_tick - explosion->creation_tick);
+		vector_push(&snapshot->explosions, &s_explosion);
+	}
+
+	for (size_t i_proj = 0; i_proj < slot_map_size(&world->projectiles);
+	     i_proj++) {
+		Projectile *projectile = slot_map_at(&world->projectiles, i_proj);
+		SProjectile s_projectile;
+		s_projectile.id = projectile->id;
+		s_projectile.position = s_position_encode(
+			kinematics_position(&world->projectile_motion, i_proj),
+			LEVEL_SIZE);
+		s_projectile.velocity = s_velocity_encode(
+			kinematics_velocity(&world->projectile_motion, i_proj));
+		s_projectile.heading =
+			s_heading_encode(projectile->heading, S_PROJECTILE_HEADING_BITS);
+		s_projectile.n_ticks_since_creation =
+			s_tick_age_encode(world->curr_tick - projectile->creation_tick);
+		vector_push(&snapshot->projectiles, &s_projectile);
+	}
+
+	snapshot_sort(snapshot);
+}
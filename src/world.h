@@ -0,0 +1,97 @@
+// The game world of one arena: players, projectiles and explosions, and the rules that advance them by a tick.
+// It doesn't know about the network, so it can be simulated on its own (see bench.c). Players carry some fields for the network code (address, session and sequence numbers), which the world leaves alone.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "color.h"
+#include "cpsock.h"
+#include "cptime.h"
+#include "grid.h"
+#include "kinematics.h"
+#include "ring.h"
+#include "serialization.h"
+#include "slotmap.h"
+#include "snapshot.h"
+#include "spawn.h"
+#include "vec2f.h"
+
+enum { FPS = 30 };
+
+extern const SVectorInt LEVEL_SIZE; // In pixels.
+extern const float SPAWN_STEP; // Spacing of the points that players can spawn at.
+extern const int PROJECTILE_LIFETIME; // In ticks.
+
+typedef struct Player {
+	SlotHandle handle; // In players.
+	SlotHandle interest; // In interests, SLOT_HANDLE_NONE until the first snapshot after joining.
+	SPlayerId id;
+	struct sockaddr_storage address;
+	uint64_t session_secret; // In its session token (see session_secret).
+
+	SPlayerInput input;
+	SSequenceNum input_sequence_num;
+	SSequenceNum ack_sim_tick_sequence_num; // Baseline for delta compression.
+	Cptime last_input_time;
+
+	bool alive;
+	int ticks_until_respawn;
+
+	Vec2f position;
+	float heading;
+	Vec2f velocity;
+	int last_shot_tick;
+
+	int score;
+	Color color;
+} Player;
+
+// Positions and velocities of projectiles are stored separately, in projectile_motion.
+typedef struct Projectile {
+	SEntityId id;
+	float heading;
+	SlotHandle shooter;
+	int creation_tick;
+} Projectile;
+
+typedef struct Explosion {
+	SEntityId id;
+	Vec2f position;
+	int creation_tick;
+} Explosion;
+
+typedef struct World {
+	SlotMap players;
+	SlotMap projectiles;
+	Kinematics projectile_motion; // Indexed like projectiles.
+	Ring explosions; // In order of creation.
+	Ring projectile_expiry; // Handles of projectiles, in order of creation.
+
+	int curr_tick;
+	SPlayerId next_player_id;
+	SEntityId next_entity_id; // For explosions and projectiles.
+
+	SpawnFinder spawn_finder; // Threats are added anew for every spawn.
+
+	// Broadphase for collision detection, rebuilt every tick.
+	Grid player_grid; // Alive players (indices into players).
+	Grid projectile_grid; // Indices into projectiles.
+} World;
+
+void world_init(World *world);
+
+Player *world_add_player(World *world);
+
+void world_add_projectile(World *world, Vec2f position, float heading,
+                          SlotHandle shooter);
+
+Vec2f world_spawn_position(World *world);
+
+void world_move(World *world);
+
+void world_detect_collisions(World *world);
+
+void world_tick(World *world);
+
+void world_capture(World *world, Snapshot *snapshot);